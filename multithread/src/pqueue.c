@@ -0,0 +1,276 @@
+/* pqueue.c */
+#define _POSIX_C_SOURCE 200809L	// sysconf
+#include "pqueue.h"
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define HEAP_INITIAL_CAPACITY 64
+// How many random picks pop_min makes before it looks at every heap.
+#define POP_ATTEMPTS 16
+
+struct entry
+{
+  long priority;
+  void *item;
+};
+
+// A binary min-heap. min mirrors entries[0].priority (LONG_MAX when
+// empty), so that pop_min can choose between heaps without locking them.
+struct heap
+{
+  pthread_mutex_t lock;
+  struct entry *entries;
+  size_t size;
+  size_t capacity;
+  long min;
+} __attribute__ ((aligned (64)));
+
+struct pqueue
+{
+  // Counts the items, plus one once the queue is closed, as in queue.c.
+  sem_t items;
+  int closed;
+  size_t n_heaps;
+  struct heap *heaps;
+};
+
+// Per-thread xorshift state, so that threads don't share a random number
+// generator (or its cache line).
+static __thread uint64_t rng_state;
+
+static size_t
+random_heap (struct pqueue *pq)
+{
+  uint64_t x = rng_state;
+  if (x == 0)
+    x = (uintptr_t) & x | 1;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  rng_state = x;
+  return x % pq->n_heaps;
+}
+
+// The caller must hold h->lock, as for the other heap functions.
+static int
+heap_push (struct heap *h, long priority, void *item)
+{
+  if (h->size == h->capacity)
+    {
+      size_t capacity = h->capacity ? 2 * h->capacity : HEAP_INITIAL_CAPACITY;
+      struct entry *entries =
+	realloc (h->entries, capacity * sizeof (struct entry));
+      if (!entries)
+	return 0;
+      h->entries = entries;
+      h->capacity = capacity;
+    }
+  size_t i = h->size++;
+  while (i > 0 && h->entries[(i - 1) / 2].priority > priority)
+    {
+      h->entries[i] = h->entries[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  h->entries[i].priority = priority;
+  h->entries[i].item = item;
+  __atomic_store_n (&h->min, h->entries[0].priority, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// h must not be empty.
+static struct entry
+heap_pop (struct heap *h)
+{
+  struct entry top = h->entries[0];
+  struct entry last = h->entries[--h->size];
+  size_t i = 0;
+  while (2 * i + 1 < h->size)
+    {
+      size_t child = 2 * i + 1;
+      if (child + 1 < h->size
+	  && h->entries[child + 1].priority < h->entries[child].priority)
+	child++;
+      if (last.priority <= h->entries[child].priority)
+	break;
+      h->entries[i] = h->entries[child];
+      i = child;
+    }
+  if (h->size)
+    h->entries[i] = last;
+  __atomic_store_n (&h->min, h->size ? h->entries[0].priority : LONG_MAX,
+		    __ATOMIC_RELAXED);
+  return top;
+}
+
+struct pqueue *
+make_pqueue (size_t n_heaps)
+{
+  if (n_heaps == 0)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      n_heaps = cpus > 0 ? 2 * cpus : 2;
+    }
+
+  struct pqueue *pq = malloc (sizeof (struct pqueue));
+  if (!pq)
+    {
+      fprintf (stderr, "Failed to allocate priority queue.\n");
+      return NULL;
+    }
+  if (posix_memalign ((void **) &pq->heaps, 64,
+		      n_heaps * sizeof (struct heap)) != 0)
+    {
+      fprintf (stderr, "Failed to allocate priority queue.\n");
+      free (pq);
+      return NULL;
+    }
+  if (sem_init (&pq->items, 0, 0) != 0)
+    {
+      fprintf (stderr, "Failed to initialize semaphore.\n");
+      free (pq->heaps);
+      free (pq);
+      return NULL;
+    }
+  pq->closed = 0;
+  pq->n_heaps = n_heaps;
+  for (size_t i = 0; i < n_heaps; i++)
+    {
+      pthread_mutex_init (&pq->heaps[i].lock, NULL);
+      pq->heaps[i].entries = NULL;
+      pq->heaps[i].size = 0;
+      pq->heaps[i].capacity = 0;
+      pq->heaps[i].min = LONG_MAX;
+    }
+  return pq;
+}
+
+void
+pqueue_push (struct pqueue *pq, long priority, void *item)
+{
+  if (!pq)
+    return;
+  if (__atomic_load_n (&pq->closed, __ATOMIC_SEQ_CST))
+    {
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+  // Skip heaps that someone else is using, rather than wait for them.
+  struct heap *h = &pq->heaps[random_heap (pq)];
+  while (pthread_mutex_trylock (&h->lock) != 0)
+    h = &pq->heaps[random_heap (pq)];
+  int pushed = heap_push (h, priority, item);
+  pthread_mutex_unlock (&h->lock);
+  if (!pushed)
+    {
+      fprintf (stderr, "Failed to grow heap.\n");
+      return;
+    }
+  sem_post (&pq->items);
+}
+
+// Take an item that the semaphore says is there. Returns QUEUE_CLOSED if
+// there wasn't one after all, which only happens when we took the close
+// count.
+static void *
+take_min (struct pqueue *pq, long *priority)
+{
+  struct entry e;
+  // Two random choices, preferring the smaller minimum.
+  for (int attempt = 0; attempt < POP_ATTEMPTS; attempt++)
+    {
+      struct heap *a = &pq->heaps[random_heap (pq)];
+      struct heap *b = &pq->heaps[random_heap (pq)];
+      if (__atomic_load_n (&b->min, __ATOMIC_RELAXED)
+	  < __atomic_load_n (&a->min, __ATOMIC_RELAXED))
+	a = b;
+      if (__atomic_load_n (&a->min, __ATOMIC_RELAXED) == LONG_MAX
+	  || pthread_mutex_trylock (&a->lock) != 0)
+	continue;
+      if (a->size)
+	{
+	  e = heap_pop (a);
+	  pthread_mutex_unlock (&a->lock);
+	  goto found;
+	}
+      pthread_mutex_unlock (&a->lock);
+    }
+  // The item may be in a heap we haven't been lucky enough to pick, or
+  // pushes may still be in flight: look everywhere, waiting for locks,
+  // until it turns up or we know the queue is closed and empty.
+  while (1)
+    {
+      for (size_t i = 0; i < pq->n_heaps; i++)
+	{
+	  struct heap *h = &pq->heaps[i];
+	  pthread_mutex_lock (&h->lock);
+	  if (h->size)
+	    {
+	      e = heap_pop (h);
+	      pthread_mutex_unlock (&h->lock);
+	      goto found;
+	    }
+	  pthread_mutex_unlock (&h->lock);
+	}
+      if (__atomic_load_n (&pq->closed, __ATOMIC_SEQ_CST))
+	{
+	  // Pass the close count on to the next consumer.
+	  sem_post (&pq->items);
+	  return QUEUE_CLOSED;
+	}
+    }
+found:
+  if (priority)
+    *priority = e.priority;
+  return e.item;
+}
+
+void *
+pqueue_pop_min (struct pqueue *pq, long *priority)
+{
+  if (!pq)
+    return NULL;
+  while (sem_wait (&pq->items) != 0)
+    ;
+  return take_min (pq, priority);
+}
+
+void *
+pqueue_try_pop_min (struct pqueue *pq, long *priority)
+{
+  if (!pq)
+    return NULL;
+  if (sem_trywait (&pq->items) != 0)
+    return __atomic_load_n (&pq->closed, __ATOMIC_SEQ_CST)
+      ? QUEUE_CLOSED : QUEUE_EMPTY;
+  return take_min (pq, priority);
+}
+
+void
+pqueue_close (struct pqueue *pq)
+{
+  if (!pq)
+    return;
+  if (__atomic_exchange_n (&pq->closed, 1, __ATOMIC_SEQ_CST))
+    return;
+  sem_post (&pq->items);
+}
+
+void
+destroy_pqueue (struct pqueue *pq)
+{
+  if (!pq)
+    return;
+  for (size_t i = 0; i < pq->n_heaps; i++)
+    {
+      pthread_mutex_destroy (&pq->heaps[i].lock);
+      free (pq->heaps[i].entries);
+    }
+  sem_destroy (&pq->items);
+  free (pq->heaps);
+  free (pq);
+}
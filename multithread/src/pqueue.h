@@ -0,0 +1,36 @@
+/* pqueue.h */
+#ifndef PQUEUE_H
+#define PQUEUE_H
+
+#include "queue.h"		// QUEUE_CLOSED, QUEUE_EMPTY
+#include <stddef.h>
+
+// A concurrent priority queue, for many threads pushing and popping at once.
+//
+// It's a relaxed MultiQueue (Rihani, Sanders and Dementiev): a set of
+// binary heaps, each behind its own lock. push adds to a random heap, and
+// pop_min looks at the minimums of two random heaps and takes the smaller.
+// So there's no lock that every thread has to take, but pop_min isn't
+// exact: it returns one of the smallest items, usually within a few times
+// the number of heaps of the true minimum. With one heap it is exact.
+// Items of equal priority come out in no particular order.
+struct pqueue;
+
+// Allocate a new, empty priority queue made of n_heaps heaps, or two per
+// online CPU if n_heaps is 0. Returns NULL on failure.
+struct pqueue *make_pqueue (size_t n_heaps);
+// Add item with the given priority. Smaller priorities come out first.
+void pqueue_push (struct pqueue *pq, long priority, void *item);
+// Remove one of the items with the smallest priority and return it,
+// blocking while the queue is empty. If priority isn't NULL, the item's
+// priority is stored there. Returns QUEUE_CLOSED instead if the queue is
+// closed and empty.
+void *pqueue_pop_min (struct pqueue *pq, long *priority);
+// Like pqueue_pop_min, but returns QUEUE_EMPTY rather than blocking.
+void *pqueue_try_pop_min (struct pqueue *pq, long *priority);
+// Close the queue, with the same meaning as queue_close.
+void pqueue_close (struct pqueue *pq);
+// Free the queue. As for destroy_queue, the items are the caller's.
+void destroy_pqueue (struct pqueue *pq);
+
+#endif // PQUEUE_H
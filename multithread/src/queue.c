@@ -1,10 +1,121 @@
 /* queue.c */
+#define _POSIX_C_SOURCE 200809L	// sem_timedwait, clock_gettime
 #include "queue.h"
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <time.h>
 
+// STATS(...) is compiled only when the queue keeps statistics.
+#ifdef QUEUE_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
+
+// Take q->lock, counting whether we had to wait for it.
+static void
+lock_queue (struct queue *q)
+{
+#ifdef QUEUE_STATS
+  int contended = pthread_mutex_trylock (&q->lock) != 0;
+  if (contended)
+    pthread_mutex_lock (&q->lock);
+  q->stats.lock_acquisitions++;
+  q->stats.contended_acquisitions += contended;
+#else
+  pthread_mutex_lock (&q->lock);
+#endif
+}
+
+#ifdef QUEUE_STATS
+static unsigned long long
+elapsed_ns (const struct timespec *since)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000000ULL
+    + now.tv_nsec - since->tv_nsec;
+}
+
+// Record that a consumer slept from start until now.
+static void
+count_blocked (struct queue *q, const struct timespec *start)
+{
+  __atomic_add_fetch (&q->stats.blocked_waits, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&q->stats.blocked_ns, elapsed_ns (start),
+		      __ATOMIC_RELAXED);
+}
+
+// Items were added to (or, for negative n, taken from) q. The caller must
+// hold q->lock.
+static void
+count_depth (struct queue *q, long n)
+{
+  q->stats.depth += n;
+  if (q->stats.depth > q->stats.peak_depth)
+    q->stats.peak_depth = q->stats.depth;
+  if (n > 0)
+    q->stats.enqueued += n;
+  else
+    q->stats.dequeued -= n;
+}
+#endif
+
+// sem_wait on q->items, timing the wait if it doesn't succeed at once.
+static void
+wait_for_item (struct queue *q)
+{
+#ifdef QUEUE_STATS
+  if (sem_trywait (&q->items) == 0)
+    return;
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  sem_wait (&q->items);
+  count_blocked (q, &start);
+#else
+  sem_wait (&q->items);
+#endif
+}
+
+// Take a node from q's free list, refilling it with a new slab if it's
+// empty. The caller must hold q->lock.
+//
+// The free list is per queue and protected by the queue's own lock, which
+// enqueue and dequeue hold anyway, so it costs a couple of pointer writes.
+// Per-thread caches in front of it would save nothing while that lock is
+// taken, and a node cached by one thread would have to find its way back
+// to the right queue's list before destroy_queue.
+static queue_node_t *
+alloc_node (struct queue *q)
+{
+  if (!q->free_nodes)
+    {
+      struct node_slab *slab = malloc (sizeof (struct node_slab));
+      if (!slab)
+	return NULL;
+      slab->next = q->slabs;
+      q->slabs = slab;
+      for (int i = 0; i < NODE_SLAB_SIZE; i++)
+	{
+	  slab->nodes[i].next = q->free_nodes;
+	  q->free_nodes = &slab->nodes[i];
+	}
+    }
+  queue_node_t *node = q->free_nodes;
+  q->free_nodes = node->next;
+  return node;
+}
+
+// Give a node back to q's free list. The caller must hold q->lock.
+static void
+free_node (struct queue *q, queue_node_t * node)
+{
+  node->next = q->free_nodes;
+  q->free_nodes = node;
+}
 
 struct queue *
 make_queue ()
@@ -19,6 +130,13 @@ make_queue ()
   // Initialize pointers
   q->head = NULL;
   q->tail = NULL;
+  q->free_nodes = NULL;
+  q->slabs = NULL;
+  q->closed = 0;
+#ifdef QUEUE_STATS
+  memset (&q->stats, 0, sizeof (q->stats));
+  clock_gettime (CLOCK_MONOTONIC, &q->created);
+#endif
 
   // Initialize the mutex
   if (pthread_mutex_init (&q->lock, NULL) != 0)
@@ -46,10 +164,22 @@ enqueue (struct queue *q, void *item)
 {
   if (!q)
     return;
+
+  // critical session
+  lock_queue (q);
+
+  if (q->closed)
+    {
+      pthread_mutex_unlock (&q->lock);
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+
   // Make a new node
-  queue_node_t *new_node = malloc (sizeof (queue_node_t));
+  queue_node_t *new_node = alloc_node (q);
   if (!new_node)
     {
+      pthread_mutex_unlock (&q->lock);
       fprintf (stderr, "Failed to init node.\n");
       return;
     }
@@ -57,9 +187,6 @@ enqueue (struct queue *q, void *item)
   new_node->next = NULL;
   new_node->prev = NULL;
 
-  // critical session
-  pthread_mutex_lock (&q->lock);
-
   if (q->tail == NULL)
     {
       // handle empty queue
@@ -73,6 +200,7 @@ enqueue (struct queue *q, void *item)
       new_node->prev = q->tail;
       q->tail = new_node;
     }
+  STATS (count_depth (q, 1));
 
   // Unlock the queue after enqueue
   pthread_mutex_unlock (&q->lock);
@@ -81,23 +209,27 @@ enqueue (struct queue *q, void *item)
   sem_post (&q->items);
 }
 
-void *
-dequeue (struct queue *q)
-{
-  if (!q)
-    return NULL;
-
-  // Wait for an item to become available
-  sem_wait (&q->items);
+// How closing works
+// -----------------
+// The semaphore counts the items in the queue, plus one once the queue is
+// closed. Whoever claims that extra count finds the queue empty, and posts
+// it again before returning QUEUE_CLOSED, so that the next blocked
+// consumer wakes up and does the same.
 
+// Remove the item at the head, having claimed a count from q->items.
+static void *
+take_front (struct queue *q)
+{
   // Lock the queue before removing the node at the head
-  pthread_mutex_lock (&q->lock);
+  lock_queue (q);
 
   queue_node_t *front = q->head;
   if (!front)
     {
+      // We claimed the count that queue_close posted; pass it on.
       pthread_mutex_unlock (&q->lock);
-      return NULL;
+      sem_post (&q->items);
+      return QUEUE_CLOSED;
     }
 
   // Remove the front node
@@ -116,7 +248,8 @@ dequeue (struct queue *q)
       q->head->prev = NULL;
     }
 
-  free (front);
+  free_node (q, front);
+  STATS (count_depth (q, -1));
 
   // Unlock the queue
   pthread_mutex_unlock (&q->lock);
@@ -124,6 +257,184 @@ dequeue (struct queue *q)
   return item;
 }
 
+void *
+dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+
+  // Wait for an item to become available
+  wait_for_item (q);
+  return take_front (q);
+}
+
+void *
+try_dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  if (sem_trywait (&q->items) == 0)
+    return take_front (q);
+
+  // Closed and empty, but another consumer is passing the closing count on.
+  lock_queue (q);
+  int closed = q->closed;
+  pthread_mutex_unlock (&q->lock);
+  return closed ? QUEUE_CLOSED : QUEUE_EMPTY;
+}
+
+void *
+dequeue_timed (struct queue *q, const struct timespec *abs_timeout)
+{
+  if (!q)
+    return NULL;
+#ifdef QUEUE_STATS
+  if (sem_trywait (&q->items) == 0)
+    return take_front (q);
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+#endif
+  while (sem_timedwait (&q->items, abs_timeout) != 0)
+    {
+      if (errno != EINTR)
+	{
+	  STATS (count_blocked (q, &start));
+	  return QUEUE_EMPTY;
+	}
+    }
+  STATS (count_blocked (q, &start));
+  return take_front (q);
+}
+
+void
+queue_close (struct queue *q)
+{
+  if (!q)
+    return;
+  lock_queue (q);
+  int was_closed = q->closed;
+  q->closed = 1;
+  pthread_mutex_unlock (&q->lock);
+  if (!was_closed)
+    sem_post (&q->items);
+}
+
+// This variant can't be polled: see queue_eventfd.c.
+int
+queue_fd (struct queue *q)
+{
+  (void) q;
+  return -1;
+}
+
+void
+enqueue_many (struct queue *q, void **items, size_t n)
+{
+  if (!q || n == 0)
+    return;
+
+  // Build the chain, then splice it onto the tail.
+  lock_queue (q);
+  if (q->closed)
+    {
+      pthread_mutex_unlock (&q->lock);
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+  queue_node_t *first = NULL, *last = NULL;
+  size_t linked;
+  for (linked = 0; linked < n; linked++)
+    {
+      queue_node_t *node = alloc_node (q);
+      if (!node)
+	{
+	  fprintf (stderr, "Failed to init node.\n");
+	  break;
+	}
+      node->item = items[linked];
+      node->next = NULL;
+      node->prev = last;
+      if (last)
+	last->next = node;
+      else
+	first = node;
+      last = node;
+    }
+  if (first)
+    {
+      if (q->tail == NULL)
+	{
+	  q->head = first;
+	}
+      else
+	{
+	  q->tail->next = first;
+	  first->prev = q->tail;
+	}
+      q->tail = last;
+    }
+  STATS (count_depth (q, linked));
+  pthread_mutex_unlock (&q->lock);
+
+  // POSIX semaphores can only be raised one at a time. sem_post only makes
+  // a system call if someone is waiting, though.
+  for (size_t i = 0; i < linked; i++)
+    sem_post (&q->items);
+}
+
+size_t
+dequeue_up_to (struct queue *q, void **out, size_t max)
+{
+  if (!q || max == 0)
+    return 0;
+
+  // Wait for the first item, then claim as many more as are there.
+  wait_for_item (q);
+  size_t n = 1;
+  while (n < max && sem_trywait (&q->items) == 0)
+    n++;
+
+  // Each count we claimed is an item in the queue, except perhaps the one
+  // queue_close posted.
+  lock_queue (q);
+  size_t taken;
+  for (taken = 0; taken < n && q->head; taken++)
+    {
+      queue_node_t *front = q->head;
+      out[taken] = front->item;
+      q->head = front->next;
+      free_node (q, front);
+    }
+  if (q->head == NULL)
+    q->tail = NULL;
+  else
+    q->head->prev = NULL;
+  STATS (count_depth (q, -(long) taken));
+  pthread_mutex_unlock (&q->lock);
+
+  if (taken < n)
+    sem_post (&q->items);	// pass the closing count on
+  return taken;
+}
+
+#ifdef QUEUE_STATS
+void
+queue_stats (struct queue *q, struct queue_stats *stats)
+{
+  // Not counted as an acquisition.
+  pthread_mutex_lock (&q->lock);
+  *stats = q->stats;
+  pthread_mutex_unlock (&q->lock);
+  stats->blocked_waits =
+    __atomic_load_n (&q->stats.blocked_waits, __ATOMIC_RELAXED);
+  stats->blocked_ns = __atomic_load_n (&q->stats.blocked_ns,
+				       __ATOMIC_RELAXED);
+  stats->elapsed = elapsed_ns (&q->created) / 1e9;
+  stats->enqueue_rate = stats->enqueued / stats->elapsed;
+  stats->dequeue_rate = stats->dequeued / stats->elapsed;
+}
+#endif
+
 void
 destroy_queue (struct queue *q)
 {
@@ -134,11 +445,12 @@ destroy_queue (struct queue *q)
   pthread_mutex_destroy (&q->lock);
   sem_destroy (&q->items);
 
-  // Free any nodes still in the queue
-  while (q->head != NULL)
+  // Free every node, including any still in the queue, by freeing the
+  // slabs they came from.
+  while (q->slabs != NULL)
     {
-      queue_node_t *tmp = q->head;
-      q->head = q->head->next;
+      struct node_slab *tmp = q->slabs;
+      q->slabs = q->slabs->next;
       free (tmp);
     }
 
@@ -19,7 +19,52 @@ typedef struct queue_node
   struct queue_node *prev;
 } queue_node_t;
 
+// Nodes are allocated NODE_SLAB_SIZE at a time, and recycled through the
+// queue's free list instead of being freed, so that after warm-up enqueue
+// and dequeue never call malloc or free.
+#define NODE_SLAB_SIZE 64
+struct node_slab
+{
+  struct node_slab *next;
+  queue_node_t nodes[NODE_SLAB_SIZE];
+};
+
+// Statistics kept by queue.c when it's built with QUEUE_STATS defined
+// (`make STATS=1`). Without it, neither the counters nor the code that
+// updates them exist.
+#ifdef QUEUE_STATS
+#include <time.h>
+struct queue_stats
+{
+  // Times the queue's lock was taken, and how many of those found it held
+  // by another thread and had to wait.
+  unsigned long long lock_acquisitions;
+  unsigned long long contended_acquisitions;
+  // Dequeues that found the queue empty and slept in sem_wait (or
+  // sem_timedwait), and their total time asleep.
+  unsigned long long blocked_waits;
+  unsigned long long blocked_ns;
+  // Items in the queue now, and the most there have ever been.
+  size_t depth;
+  size_t peak_depth;
+  unsigned long long enqueued;
+  unsigned long long dequeued;
+  // Seconds since make_queue, and enqueued and dequeued per second over
+  // that time.
+  double elapsed;
+  double enqueue_rate;
+  double dequeue_rate;
+};
+#endif
+
 // Overall queue structure.
+// Other implementations of this interface can be chosen at build time with
+// `make QUEUE=<variant>` (see the Makefile). Those are built with
+// QUEUE_OPAQUE defined, and keep their own definition of the structure, so
+// users of the queue must only ever go through the functions below.
+#ifdef QUEUE_OPAQUE
+struct queue;
+#else
 struct queue
 {
   // fill in whatever additional fields you want for your queue structure.
@@ -28,7 +73,27 @@ struct queue
   queue_node_t *tail;
   pthread_mutex_t lock;
   sem_t items;
+  // Unused nodes, linked through next, and every slab we've allocated.
+  // Both are protected by lock.
+  queue_node_t *free_nodes;
+  struct node_slab *slabs;
+  // Set by queue_close, under lock.
+  int closed;
+#ifdef QUEUE_STATS
+  // Protected by lock, except blocked_waits and blocked_ns, which are
+  // updated atomically.
+  struct queue_stats stats;
+  struct timespec created;
+#endif
 };
+#endif
+
+// Special return values of the dequeue functions. These are never valid
+// items, so don't enqueue them.
+// QUEUE_CLOSED: the queue has been closed and every item has been dequeued.
+#define QUEUE_CLOSED ((void *) -1)
+// QUEUE_EMPTY: try_dequeue found no item, or dequeue_timed timed out.
+#define QUEUE_EMPTY ((void *) -2)
 
 // Function prototypes:
 
@@ -38,7 +103,36 @@ struct queue *make_queue ();
 void enqueue (struct queue *q, void *item);
 // Dequeue the given item from the queue. This should be a blocking operation:
 // if the queue is empty, the calling thread is blocked until an item is available.
+// Returns QUEUE_CLOSED instead if the queue is closed and empty.
 void *dequeue (struct queue *q);
+// Like dequeue, but returns QUEUE_EMPTY rather than blocking.
+void *try_dequeue (struct queue *q);
+// Like dequeue, but gives up and returns QUEUE_EMPTY at abs_timeout, which
+// is measured against CLOCK_REALTIME, as for sem_timedwait.
+void *dequeue_timed (struct queue *q, const struct timespec *abs_timeout);
+// Close the queue: no more items may be enqueued (attempts are reported
+// and ignored). Items already in the queue can still be dequeued. After
+// that, every blocked and future dequeue returns QUEUE_CLOSED.
+// Closing a closed queue does nothing.
+void queue_close (struct queue *q);
+// A file descriptor that polls readable (POLLIN) whenever a dequeue may
+// not block, for waiting on the queue with poll or epoll alongside other
+// descriptors; then use try_dequeue. Only the eventfd variant has one:
+// the others return -1. The descriptor belongs to the queue, so don't
+// close it.
+int queue_fd (struct queue *q);
+// Enqueue items[0..n-1], in order, as if by n calls to enqueue but with a
+// single trip through the queue's lock.
+void enqueue_many (struct queue *q, void **items, size_t n);
+// Dequeue between 1 and max items into out, in order, and return how many.
+// Blocks like dequeue until at least one item is available, but doesn't
+// wait for more than that. Returns 0 if the queue is closed and empty.
+size_t dequeue_up_to (struct queue *q, void **out, size_t max);
+#ifdef QUEUE_STATS
+// Fill in *stats with a snapshot of q's statistics. Only queue.c keeps
+// them.
+void queue_stats (struct queue *q, struct queue_stats *stats);
+#endif
 // Destroy the given queue, freeing or releasing any resources that it was using.
 // This does NOT include freeing the data items -- that is the user's responsibility.
 // It does include freeing all of the nodes, and any bookkeeping or synchronization resources
@@ -0,0 +1,233 @@
+/* queue_bench.c */
+// Throughput and latency of whichever queue implementation this was built
+// with (`make QUEUE=<variant> queue_bench`). `make bench` runs it for every
+// variant.
+//
+// Sweeps the number of producers and of consumers, each in powers of two
+// up to MAX_THREADS (64 by default), and the item size. Producers malloc
+// each item, fill it, stamp it with the time and enqueue it; consumers
+// dequeue it, read it and free it, until the queue is closed. Output is
+// CSV:
+// variant,producers,consumers,item_size,ops_per_sec,p50_ns,p99_ns,p999_ns
+// where each item enqueued and each item dequeued is one op, and the
+// percentiles are of the time from just before enqueue to just after
+// dequeue.
+//
+// Producers stop to let consumers catch up when MAX_IN_FLIGHT items are
+// queued. Otherwise the unbounded variants would mostly measure how long
+// the backlog has grown, and the ring would fill up, and the variants
+// wouldn't be compared under the same load.
+#define _POSIX_C_SOURCE 200809L	// clock_gettime
+#include "queue.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#ifndef QUEUE_VARIANT
+#define QUEUE_VARIANT "mutex"
+#endif
+
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_ITEMS 200000
+#define MAX_IN_FLIGHT 1024
+
+// Latency histogram, in the style of HdrHistogram: values below SUB_COUNT
+// get a bucket each, and every power of two above that is split into
+// SUB_COUNT buckets, so any value is recorded to within 1/SUB_COUNT (~3%).
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+#define HIST_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+struct histogram
+{
+  uint64_t total;
+  uint64_t counts[HIST_BUCKETS];
+};
+
+static size_t
+bucket_of (uint64_t value)
+{
+  if (value < SUB_COUNT)
+    return value;
+  int shift = 63 - __builtin_clzll (value) - SUB_BITS;
+  return (shift + 1) * SUB_COUNT + (value >> shift) - SUB_COUNT;
+}
+
+// The largest value that lands in bucket i.
+static uint64_t
+bucket_max (size_t i)
+{
+  if (i < SUB_COUNT)
+    return i;
+  int shift = i / SUB_COUNT - 1;
+  uint64_t sub = i % SUB_COUNT;
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+static void
+record (struct histogram *h, uint64_t value)
+{
+  h->counts[bucket_of (value)]++;
+  h->total++;
+}
+
+static void
+merge (struct histogram *into, const struct histogram *h)
+{
+  for (size_t i = 0; i < HIST_BUCKETS; i++)
+    into->counts[i] += h->counts[i];
+  into->total += h->total;
+}
+
+// The smallest recorded value that at least fraction p of them are <=.
+static uint64_t
+percentile (const struct histogram *h, double p)
+{
+  uint64_t target = p * h->total;
+  if (target < p * h->total)
+    target++;
+  if (target == 0)
+    target = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+      seen += h->counts[i];
+      if (seen >= target)
+	return bucket_max (i);
+    }
+  return 0;
+}
+
+struct item
+{
+  uint64_t enqueued_ns;
+  unsigned char payload[];
+};
+
+struct queue *q = NULL;
+long items_per_producer;
+size_t item_size;
+long in_flight;
+
+struct consumer
+{
+  pthread_t tid;
+  unsigned long sink;
+  struct histogram latency;
+};
+
+static uint64_t
+now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void *
+producer_thread (void *arg)
+{
+  (void) arg;
+  size_t payload = item_size - sizeof (struct item);
+  for (long i = 0; i < items_per_producer; ++i)
+    {
+      struct item *item = malloc (item_size);
+      if (!item)
+	{
+	  fprintf (stderr, "Memory allocation error\n");
+	  exit (EXIT_FAILURE);
+	}
+      memset (item->payload, (int) i, payload);
+      while (__atomic_load_n (&in_flight, __ATOMIC_RELAXED) >= MAX_IN_FLIGHT)
+	sched_yield ();
+      __atomic_add_fetch (&in_flight, 1, __ATOMIC_RELAXED);
+      item->enqueued_ns = now_ns ();
+      enqueue (q, item);
+    }
+  return NULL;
+}
+
+void *
+consumer_thread (void *arg)
+{
+  struct consumer *c = arg;
+  size_t payload = item_size - sizeof (struct item);
+  struct item *item;
+  while ((item = dequeue (q)) != QUEUE_CLOSED)
+    {
+      record (&c->latency, now_ns () - item->enqueued_ns);
+      __atomic_sub_fetch (&in_flight, 1, __ATOMIC_RELAXED);
+      for (size_t i = 0; i < payload; i++)
+	c->sink += item->payload[i];
+      free (item);
+    }
+  return NULL;
+}
+
+// Prints one CSV row.
+void
+run (int producers, int consumers, size_t size, long items)
+{
+  pthread_t *tids = calloc (producers, sizeof (pthread_t));
+  struct consumer *cs = calloc (consumers, sizeof (struct consumer));
+  struct histogram *latency = calloc (1, sizeof (struct histogram));
+  if (!tids || !cs || !latency)
+    {
+      fprintf (stderr, "Memory allocation error\n");
+      exit (EXIT_FAILURE);
+    }
+  q = make_queue ();
+  item_size = size;
+  items_per_producer = items / producers;
+  items = items_per_producer * producers;
+  in_flight = 0;
+
+  uint64_t start = now_ns ();
+  for (int i = 0; i < consumers; ++i)
+    pthread_create (&cs[i].tid, NULL, consumer_thread, &cs[i]);
+  for (int i = 0; i < producers; ++i)
+    pthread_create (&tids[i], NULL, producer_thread, NULL);
+  for (int i = 0; i < producers; ++i)
+    pthread_join (tids[i], NULL);
+  // Consumers finish what's queued, then see QUEUE_CLOSED.
+  queue_close (q);
+  for (int i = 0; i < consumers; ++i)
+    {
+      pthread_join (cs[i].tid, NULL);
+      merge (latency, &cs[i].latency);
+    }
+  double elapsed = (now_ns () - start) / 1e9;
+  destroy_queue (q);
+
+  printf ("%s,%d,%d,%zu,%.0f,%llu,%llu,%llu\n", QUEUE_VARIANT, producers,
+	  consumers, size, 2 * items / elapsed,
+	  (unsigned long long) percentile (latency, 0.5),
+	  (unsigned long long) percentile (latency, 0.99),
+	  (unsigned long long) percentile (latency, 0.999));
+  fflush (stdout);
+  free (latency);
+  free (cs);
+  free (tids);
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const size_t sizes[] = { sizeof (struct item), 64, 1024 };
+  long items = argc > 1 ? atol (argv[1]) : DEFAULT_ITEMS;
+  int max_threads = argc > 2 ? atoi (argv[2]) : DEFAULT_MAX_THREADS;
+  if (items <= 0 || max_threads <= 0)
+    {
+      fprintf (stderr, "Usage: %s [ITEMS [MAX_THREADS]]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); ++s)
+    for (int producers = 1; producers <= max_threads; producers *= 2)
+      for (int consumers = 1; consumers <= max_threads; consumers *= 2)
+	run (producers, consumers, sizes[s], items);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,281 @@
+/* queue_eventfd.c */
+// Pollable variant of the synchronized queue: build with
+// `make QUEUE=eventfd`.
+//
+// This is queue.c with the semaphore replaced by an eventfd in semaphore
+// mode. The eventfd's counter is the semaphore count: each item adds one
+// and each read takes one. The difference is that queue_fd hands out the
+// descriptor, so an event loop can wait for the queue with poll, select or
+// epoll together with sockets, pipes, signalfds and timerfds. When the fd
+// polls readable, call try_dequeue. It may still return QUEUE_EMPTY if
+// another consumer got there first, and it returns QUEUE_CLOSED once the
+// queue is closed and drained (a closed queue stays readable).
+//
+// Items are kept in an array used as a ring, under one lock.
+#define _GNU_SOURCE		// ppoll
+#include "queue.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUEUE_INITIAL_CAPACITY 64
+
+struct queue
+{
+  pthread_mutex_t lock;
+  void **items;
+  size_t head;
+  size_t count;
+  size_t capacity;
+  // Set by queue_close, under lock.
+  int closed;
+  // Counts the items, plus one once the queue is closed. Non-blocking:
+  // waiting is done with poll.
+  int fd;
+};
+
+struct queue *
+make_queue ()
+{
+  struct queue *q = malloc (sizeof (struct queue));
+  if (!q)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      return NULL;
+    }
+  q->items = NULL;
+  q->head = 0;
+  q->count = 0;
+  q->capacity = 0;
+  q->closed = 0;
+  if (pthread_mutex_init (&q->lock, NULL) != 0)
+    {
+      fprintf (stderr, "Failed to initialize mutex.\n");
+      free (q);
+      return NULL;
+    }
+  q->fd = eventfd (0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->fd < 0)
+    {
+      fprintf (stderr, "Failed to create eventfd.\n");
+      pthread_mutex_destroy (&q->lock);
+      free (q);
+      return NULL;
+    }
+  return q;
+}
+
+int
+queue_fd (struct queue *q)
+{
+  return q ? q->fd : -1;
+}
+
+// Add n to the count.
+static void
+post (struct queue *q, uint64_t n)
+{
+  while (write (q->fd, &n, sizeof (n)) < 0 && errno == EINTR)
+    ;
+}
+
+// Take one from the count if it isn't 0. Returns 0 if it was.
+static int
+try_claim (struct queue *q)
+{
+  uint64_t n;
+  while (read (q->fd, &n, sizeof (n)) < 0)
+    {
+      if (errno != EINTR)
+	return 0;
+    }
+  return 1;
+}
+
+// Take one from the count, waiting until abs_timeout (CLOCK_REALTIME, or
+// NULL to wait forever). Returns 0 if it timed out.
+static int
+claim (struct queue *q, const struct timespec *abs_timeout)
+{
+  while (!try_claim (q))
+    {
+      struct pollfd pfd = {.fd = q->fd,.events = POLLIN };
+      struct timespec left, *timeout = NULL;
+      if (abs_timeout)
+	{
+	  struct timespec now;
+	  clock_gettime (CLOCK_REALTIME, &now);
+	  left.tv_sec = abs_timeout->tv_sec - now.tv_sec;
+	  left.tv_nsec = abs_timeout->tv_nsec - now.tv_nsec;
+	  if (left.tv_nsec < 0)
+	    {
+	      left.tv_sec--;
+	      left.tv_nsec += 1000000000;
+	    }
+	  if (left.tv_sec < 0)
+	    return 0;
+	  timeout = &left;
+	}
+      // Another consumer may claim the count between the poll and our
+      // read, so go round again either way.
+      ppoll (&pfd, 1, timeout, NULL);
+    }
+  return 1;
+}
+
+static int
+push (struct queue *q, void *item)
+{
+  if (q->count == q->capacity)
+    {
+      size_t capacity = q->capacity ? 2 * q->capacity
+	: QUEUE_INITIAL_CAPACITY;
+      void **items = malloc (capacity * sizeof (void *));
+      if (!items)
+	return 0;
+      // Unwrap the ring into the new array.
+      for (size_t i = 0; i < q->count; i++)
+	items[i] = q->items[(q->head + i) % q->capacity];
+      free (q->items);
+      q->items = items;
+      q->head = 0;
+      q->capacity = capacity;
+    }
+  q->items[(q->head + q->count++) % q->capacity] = item;
+  return 1;
+}
+
+void
+enqueue (struct queue *q, void *item)
+{
+  enqueue_many (q, &item, 1);
+}
+
+void
+enqueue_many (struct queue *q, void **items, size_t n)
+{
+  if (!q || n == 0)
+    return;
+  pthread_mutex_lock (&q->lock);
+  if (q->closed)
+    {
+      pthread_mutex_unlock (&q->lock);
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+  size_t pushed;
+  for (pushed = 0; pushed < n; pushed++)
+    {
+      if (!push (q, items[pushed]))
+	{
+	  fprintf (stderr, "Failed to grow queue.\n");
+	  break;
+	}
+    }
+  pthread_mutex_unlock (&q->lock);
+  // Unlike sem_post, one write adds them all.
+  if (pushed)
+    post (q, pushed);
+}
+
+// Remove the item at the head, having claimed a count.
+static void *
+take_front (struct queue *q)
+{
+  pthread_mutex_lock (&q->lock);
+  if (q->count == 0)
+    {
+      // We claimed the count that queue_close posted; pass it on.
+      pthread_mutex_unlock (&q->lock);
+      post (q, 1);
+      return QUEUE_CLOSED;
+    }
+  void *item = q->items[q->head];
+  q->head = (q->head + 1) % q->capacity;
+  q->count--;
+  pthread_mutex_unlock (&q->lock);
+  return item;
+}
+
+void *
+dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  claim (q, NULL);
+  return take_front (q);
+}
+
+void *
+try_dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  if (try_claim (q))
+    return take_front (q);
+
+  // Closed and empty, but another consumer is passing the closing count on.
+  pthread_mutex_lock (&q->lock);
+  int closed = q->closed;
+  pthread_mutex_unlock (&q->lock);
+  return closed ? QUEUE_CLOSED : QUEUE_EMPTY;
+}
+
+void *
+dequeue_timed (struct queue *q, const struct timespec *abs_timeout)
+{
+  if (!q)
+    return NULL;
+  if (!claim (q, abs_timeout))
+    return QUEUE_EMPTY;
+  return take_front (q);
+}
+
+void
+queue_close (struct queue *q)
+{
+  if (!q)
+    return;
+  pthread_mutex_lock (&q->lock);
+  int was_closed = q->closed;
+  q->closed = 1;
+  pthread_mutex_unlock (&q->lock);
+  if (!was_closed)
+    post (q, 1);
+}
+
+size_t
+dequeue_up_to (struct queue *q, void **out, size_t max)
+{
+  if (!q || max == 0)
+    return 0;
+  claim (q, NULL);
+  size_t n = 0;
+  do
+    {
+      out[n] = take_front (q);
+      if (out[n] == QUEUE_CLOSED)
+	break;
+      n++;
+    }
+  while (n < max && try_claim (q));
+  return n;
+}
+
+void
+destroy_queue (struct queue *q)
+{
+  if (!q)
+    return;
+  // The items are the user's.
+  close (q->fd);
+  pthread_mutex_destroy (&q->lock);
+  free (q->items);
+  free (q);
+}
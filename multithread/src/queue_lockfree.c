@@ -0,0 +1,474 @@
+/* queue_lockfree.c */
+// Lock-free variant of the synchronized queue: build with
+// `make QUEUE=lockfree`.
+//
+// The list is a Michael-Scott queue: a singly linked list that always
+// starts with a dummy node, with head and tail swung forward by CAS, so
+// producers and consumers never wait for each other. A dequeued node can't
+// be freed right away, because another thread may still be reading it
+// (its next pointer, or the item in the node after it). Each thread
+// announces the nodes it's about to read in its hazard pointers, and
+// retired nodes are only freed once no hazard pointer refers to them.
+//
+// Blocking is still done with the semaphore, which counts the items in
+// the queue: glibc's sem_wait/sem_post only enter the kernel when a thread
+// actually has to sleep or be woken.
+#define _POSIX_C_SOURCE 200809L	// posix_memalign
+#include "queue.h"
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct lf_node
+{
+  void *item;
+  struct lf_node *next;
+} lf_node_t;
+
+struct queue
+{
+  // head and tail are on separate cache lines, so that producers and
+  // consumers don't invalidate each other's.
+  lf_node_t *head __attribute__ ((aligned (64)));
+  lf_node_t *tail __attribute__ ((aligned (64)));
+  sem_t items __attribute__ ((aligned (64)));
+  // Set by queue_close. As in queue.c, closing posts one extra count to
+  // items, which each consumer that finds the queue empty passes on.
+  int closed;
+};
+
+// Hazard pointers
+// ---------------
+// Every thread that has used a lock-free queue owns a record in a global,
+// grow-only list. Records are shared by all queues, and are handed on to a
+// new thread when their thread exits. A thread frees its retired nodes once
+// it has RETIRE_THRESHOLD of them, skipping any that are still hazardous.
+
+#define HAZARDS_PER_THREAD 2
+#define RETIRE_THRESHOLD 128
+
+struct hp_record
+{
+  lf_node_t *hazard[HAZARDS_PER_THREAD];
+  int in_use;
+  struct hp_record *next;
+  lf_node_t **retired;
+  size_t n_retired;
+  size_t retired_cap;
+};
+
+static struct hp_record *hp_records = NULL;
+static __thread struct hp_record *my_record = NULL;
+static pthread_key_t hp_key;
+static pthread_once_t hp_key_once = PTHREAD_ONCE_INIT;
+
+static void
+release_record (void *r)
+{
+  struct hp_record *record = r;
+  for (int i = 0; i < HAZARDS_PER_THREAD; i++)
+    __atomic_store_n (&record->hazard[i], NULL, __ATOMIC_RELEASE);
+  __atomic_store_n (&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+make_hp_key ()
+{
+  pthread_key_create (&hp_key, release_record);
+}
+
+static struct hp_record *
+acquire_record ()
+{
+  if (my_record)
+    return my_record;
+  pthread_once (&hp_key_once, make_hp_key);
+
+  // Reuse the record of a thread that has exited, if there is one.
+  struct hp_record *r;
+  for (r = __atomic_load_n (&hp_records, __ATOMIC_ACQUIRE); r; r = r->next)
+    {
+      int free_record = 0;
+      if (__atomic_compare_exchange_n (&r->in_use, &free_record, 1, 0,
+				       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	break;
+    }
+  if (!r)
+    {
+      r = calloc (1, sizeof (struct hp_record));
+      if (!r)
+	{
+	  fprintf (stderr, "Failed to allocate hazard pointer record.\n");
+	  abort ();
+	}
+      r->in_use = 1;
+      r->next = __atomic_load_n (&hp_records, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&hp_records, &r->next, r, 1,
+					   __ATOMIC_RELEASE,
+					   __ATOMIC_RELAXED));
+    }
+  pthread_setspecific (hp_key, r);
+  my_record = r;
+  return r;
+}
+
+// Publish *src in hazard slot i, and return it once it is known to have
+// still been in *src after it was published: from then on, it can't be
+// freed until the slot is cleared.
+static lf_node_t *
+protect (struct hp_record *r, int i, lf_node_t ** src)
+{
+  lf_node_t *node = __atomic_load_n (src, __ATOMIC_ACQUIRE);
+  while (1)
+    {
+      __atomic_store_n (&r->hazard[i], node, __ATOMIC_SEQ_CST);
+      lf_node_t *again = __atomic_load_n (src, __ATOMIC_SEQ_CST);
+      if (again == node)
+	return node;
+      node = again;
+    }
+}
+
+static int
+is_hazardous (lf_node_t * node)
+{
+  for (struct hp_record * r = __atomic_load_n (&hp_records, __ATOMIC_ACQUIRE);
+       r; r = r->next)
+    {
+      for (int i = 0; i < HAZARDS_PER_THREAD; i++)
+	{
+	  if (__atomic_load_n (&r->hazard[i], __ATOMIC_SEQ_CST) == node)
+	    return 1;
+	}
+    }
+  return 0;
+}
+
+// Free every node r has retired that no thread is about to read.
+static void
+scan (struct hp_record *r)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < r->n_retired; i++)
+    {
+      if (is_hazardous (r->retired[i]))
+	r->retired[kept++] = r->retired[i];
+      else
+	free (r->retired[i]);
+    }
+  r->n_retired = kept;
+}
+
+static void
+retire (struct hp_record *r, lf_node_t * node)
+{
+  if (r->n_retired == r->retired_cap)
+    {
+      size_t cap = r->retired_cap ? 2 * r->retired_cap : RETIRE_THRESHOLD;
+      lf_node_t **retired = realloc (r->retired, cap * sizeof (lf_node_t *));
+      if (!retired)
+	{
+	  // Better to scan early than to lose track of the node.
+	  scan (r);
+	  if (r->n_retired == r->retired_cap)
+	    {
+	      fprintf (stderr, "Failed to retire node.\n");
+	      abort ();
+	    }
+	}
+      else
+	{
+	  r->retired = retired;
+	  r->retired_cap = cap;
+	}
+    }
+  r->retired[r->n_retired++] = node;
+  if (r->n_retired >= RETIRE_THRESHOLD)
+    scan (r);
+}
+
+struct queue *
+make_queue ()
+{
+  struct queue *q;
+  if (posix_memalign ((void **) &q, 64, sizeof (struct queue)) != 0)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      return NULL;
+    }
+
+  lf_node_t *dummy = malloc (sizeof (lf_node_t));
+  if (!dummy)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      free (q);
+      return NULL;
+    }
+  dummy->item = NULL;
+  dummy->next = NULL;
+  q->head = dummy;
+  q->tail = dummy;
+  q->closed = 0;
+
+  if (sem_init (&q->items, 0, 0) != 0)
+    {
+      fprintf (stderr, "Failed to initialize semaphore.\n");
+      free (dummy);
+      free (q);
+      return NULL;
+    }
+  return q;
+}
+
+// Enqueues racing with queue_close may still get in; consumers will find
+// their items before they find the queue empty.
+static int
+reject_if_closed (struct queue *q)
+{
+  if (!__atomic_load_n (&q->closed, __ATOMIC_ACQUIRE))
+    return 0;
+  fprintf (stderr, "Enqueue to a closed queue.\n");
+  return 1;
+}
+
+void
+enqueue (struct queue *q, void *item)
+{
+  if (!q || reject_if_closed (q))
+    return;
+  lf_node_t *node = malloc (sizeof (lf_node_t));
+  if (!node)
+    {
+      fprintf (stderr, "Failed to init node.\n");
+      return;
+    }
+  node->item = item;
+  node->next = NULL;
+
+  struct hp_record *r = acquire_record ();
+  while (1)
+    {
+      lf_node_t *tail = protect (r, 0, &q->tail);
+      lf_node_t *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+      if (tail != __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE))
+	continue;
+      if (next)
+	{
+	  // tail is lagging behind; help it along, then try again.
+	  __atomic_compare_exchange_n (&q->tail, &tail, next, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	  continue;
+	}
+      if (__atomic_compare_exchange_n (&tail->next, &next, node, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	  // Linked in. If this fails, someone else has already helped.
+	  __atomic_compare_exchange_n (&q->tail, &tail, node, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	  break;
+	}
+    }
+  __atomic_store_n (&r->hazard[0], NULL, __ATOMIC_RELEASE);
+
+  // Signal that a new item is available
+  sem_post (&q->items);
+}
+
+// Unlink the first item. The caller must have claimed a count from
+// q->items. If that was the count queue_close posted, there may be no
+// item; then pass the count on and return QUEUE_CLOSED.
+static void *
+pop (struct queue *q)
+{
+  struct hp_record *r = acquire_record ();
+  lf_node_t *head;
+  void *item;
+  while (1)
+    {
+      head = protect (r, 0, &q->head);
+      lf_node_t *tail = __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+      lf_node_t *next = protect (r, 1, &head->next);
+      if (head != __atomic_load_n (&q->head, __ATOMIC_ACQUIRE))
+	continue;
+      if (!next)
+	{
+	  // Items are linked in before they're counted, so an empty list
+	  // means we claimed the closing count.
+	  if (__atomic_load_n (&q->closed, __ATOMIC_ACQUIRE))
+	    {
+	      __atomic_store_n (&r->hazard[0], NULL, __ATOMIC_RELEASE);
+	      __atomic_store_n (&r->hazard[1], NULL, __ATOMIC_RELEASE);
+	      sem_post (&q->items);
+	      return QUEUE_CLOSED;
+	    }
+	  continue;
+	}
+      if (head == tail)
+	{
+	  __atomic_compare_exchange_n (&q->tail, &tail, next, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	  continue;
+	}
+      // Read the item before swinging head: afterwards, next is the new
+      // dummy, and another dequeue may retire it.
+      item = next->item;
+      if (__atomic_compare_exchange_n (&q->head, &head, next, 0,
+				       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	break;
+    }
+  __atomic_store_n (&r->hazard[0], NULL, __ATOMIC_RELEASE);
+  __atomic_store_n (&r->hazard[1], NULL, __ATOMIC_RELEASE);
+  retire (r, head);
+  return item;
+}
+
+void *
+dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+
+  // Wait for an item to become available. Once we have, there is an item
+  // in the list that nobody else can take, though we may need a few tries
+  // to get to it.
+  sem_wait (&q->items);
+  return pop (q);
+}
+
+void *
+try_dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  if (sem_trywait (&q->items) == 0)
+    return pop (q);
+  return __atomic_load_n (&q->closed, __ATOMIC_ACQUIRE) ? QUEUE_CLOSED
+    : QUEUE_EMPTY;
+}
+
+void *
+dequeue_timed (struct queue *q, const struct timespec *abs_timeout)
+{
+  if (!q)
+    return NULL;
+  while (sem_timedwait (&q->items, abs_timeout) != 0)
+    {
+      if (errno != EINTR)
+	return QUEUE_EMPTY;
+    }
+  return pop (q);
+}
+
+void
+queue_close (struct queue *q)
+{
+  if (!q)
+    return;
+  if (__atomic_exchange_n (&q->closed, 1, __ATOMIC_ACQ_REL) == 0)
+    sem_post (&q->items);
+}
+
+// This variant can't be polled: see queue_eventfd.c.
+int
+queue_fd (struct queue *q)
+{
+  (void) q;
+  return -1;
+}
+
+void
+enqueue_many (struct queue *q, void **items, size_t n)
+{
+  if (!q || n == 0 || reject_if_closed (q))
+    return;
+
+  // Build the chain privately, then link it in with the same CAS that
+  // enqueue uses for a single node. Other threads swing the tail along
+  // the chain one node at a time if they get there first.
+  lf_node_t *first = NULL, *last = NULL;
+  size_t linked;
+  for (linked = 0; linked < n; linked++)
+    {
+      lf_node_t *node = malloc (sizeof (lf_node_t));
+      if (!node)
+	{
+	  fprintf (stderr, "Failed to init node.\n");
+	  break;
+	}
+      node->item = items[linked];
+      node->next = NULL;
+      if (last)
+	last->next = node;
+      else
+	first = node;
+      last = node;
+    }
+  if (!first)
+    return;
+
+  struct hp_record *r = acquire_record ();
+  while (1)
+    {
+      lf_node_t *tail = protect (r, 0, &q->tail);
+      lf_node_t *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+      if (tail != __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE))
+	continue;
+      if (next)
+	{
+	  __atomic_compare_exchange_n (&q->tail, &tail, next, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	  continue;
+	}
+      if (__atomic_compare_exchange_n (&tail->next, &next, first, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	{
+	  __atomic_compare_exchange_n (&q->tail, &tail, last, 0,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	  break;
+	}
+    }
+  __atomic_store_n (&r->hazard[0], NULL, __ATOMIC_RELEASE);
+
+  for (size_t i = 0; i < linked; i++)
+    sem_post (&q->items);
+}
+
+size_t
+dequeue_up_to (struct queue *q, void **out, size_t max)
+{
+  if (!q || max == 0)
+    return 0;
+  sem_wait (&q->items);
+  size_t n = 1;
+  while (n < max && sem_trywait (&q->items) == 0)
+    n++;
+  size_t taken = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      void *item = pop (q);
+      if (item != QUEUE_CLOSED)
+	out[taken++] = item;
+    }
+  return taken;
+}
+
+void
+destroy_queue (struct queue *q)
+{
+  if (!q)
+    return;
+
+  sem_destroy (&q->items);
+
+  // Free the dummy node and any nodes still in the queue. Nodes that
+  // threads have retired are freed by those threads' later scans.
+  while (q->head != NULL)
+    {
+      lf_node_t *tmp = q->head;
+      q->head = q->head->next;
+      free (tmp);
+    }
+
+  free (q);
+}
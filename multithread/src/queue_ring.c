@@ -0,0 +1,336 @@
+/* queue_ring.c */
+// Bounded variant of the synchronized queue: build with `make QUEUE=ring`.
+//
+// Items live in a fixed array of QUEUE_RING_CAPACITY cells, using Dmitry
+// Vyukov's bounded MPMC algorithm: every cell has a sequence number that
+// says whether it's ready to be written (seq == pos) or read
+// (seq == pos + 1) by whoever claims position pos. Producers and consumers
+// claim positions with a CAS on their own counter and then touch only their
+// cell. So after make_queue, nothing is allocated, and there are no nodes
+// to chase.
+//
+// enqueue blocks while the queue is full and dequeue while it's empty.
+// Sleeping is done with a futex per direction. A thread that finds it has
+// to wait registers itself, checks once more, and then sleeps until the
+// futex word changes. The other side only makes a system call to wake it
+// when someone is registered.
+#define _GNU_SOURCE		// syscall
+#include "queue.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Must be a power of two. It's large by default because test_queue
+// enqueues 10000 items before dequeuing any.
+#ifndef QUEUE_RING_CAPACITY
+#define QUEUE_RING_CAPACITY (1 << 14)
+#endif
+#if QUEUE_RING_CAPACITY & (QUEUE_RING_CAPACITY - 1)
+#error QUEUE_RING_CAPACITY must be a power of two
+#endif
+
+struct cell
+{
+  size_t seq;
+  void *item;
+};
+
+// One direction's sleepers: waiters counts them, and word changes whenever
+// they should re-check.
+struct waitpoint
+{
+  unsigned word;
+  unsigned waiters;
+};
+
+struct queue
+{
+  size_t enqueue_pos __attribute__ ((aligned (64)));
+  size_t dequeue_pos __attribute__ ((aligned (64)));
+  struct waitpoint not_full __attribute__ ((aligned (64)));
+  struct waitpoint not_empty __attribute__ ((aligned (64)));
+  int closed;
+  struct cell cells[QUEUE_RING_CAPACITY] __attribute__ ((aligned (64)));
+};
+
+// Sleep while *word == expected, until abs_timeout (CLOCK_REALTIME) if it
+// isn't NULL. Returns 0 if the timeout passed.
+static int
+futex_wait (unsigned *word, unsigned expected,
+	    const struct timespec *abs_timeout)
+{
+  if (!abs_timeout)
+    {
+      syscall (SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+      return 1;
+    }
+  long r = syscall (SYS_futex, word,
+		    FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME,
+		    expected, abs_timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+  return !(r == -1 && errno == ETIMEDOUT);
+}
+
+static void
+futex_wake (unsigned *word, int n)
+{
+  syscall (SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// Wake one sleeper at w, if there is one.
+static void
+signal_waitpoint (struct waitpoint *w)
+{
+  // Pairs with the fence in register_waiter: either we see the waiter, or
+  // its last check sees what we just did.
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&w->waiters, __ATOMIC_SEQ_CST))
+    {
+      __atomic_add_fetch (&w->word, 1, __ATOMIC_SEQ_CST);
+      futex_wake (&w->word, 1);
+    }
+}
+
+// Returns the word to wait on if the last check fails.
+static unsigned
+register_waiter (struct waitpoint *w)
+{
+  unsigned word = __atomic_load_n (&w->word, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&w->waiters, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  return word;
+}
+
+// Non-blocking halves of enqueue and dequeue. Return 0 if the queue was
+// full (or empty).
+static int
+try_push (struct queue *q, void *item)
+{
+  size_t pos = __atomic_load_n (&q->enqueue_pos, __ATOMIC_RELAXED);
+  while (1)
+    {
+      struct cell *c = &q->cells[pos & (QUEUE_RING_CAPACITY - 1)];
+      size_t seq = __atomic_load_n (&c->seq, __ATOMIC_ACQUIRE);
+      intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+      if (dif == 0)
+	{
+	  if (__atomic_compare_exchange_n (&q->enqueue_pos, &pos, pos + 1, 1,
+					   __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED))
+	    {
+	      c->item = item;
+	      __atomic_store_n (&c->seq, pos + 1, __ATOMIC_RELEASE);
+	      return 1;
+	    }
+	  // pos was reloaded by the failed CAS.
+	}
+      else if (dif < 0)
+	return 0;
+      else
+	pos = __atomic_load_n (&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+}
+
+static int
+try_pop (struct queue *q, void **item)
+{
+  size_t pos = __atomic_load_n (&q->dequeue_pos, __ATOMIC_RELAXED);
+  while (1)
+    {
+      struct cell *c = &q->cells[pos & (QUEUE_RING_CAPACITY - 1)];
+      size_t seq = __atomic_load_n (&c->seq, __ATOMIC_ACQUIRE);
+      intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+      if (dif == 0)
+	{
+	  if (__atomic_compare_exchange_n (&q->dequeue_pos, &pos, pos + 1, 1,
+					   __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED))
+	    {
+	      *item = c->item;
+	      __atomic_store_n (&c->seq, pos + QUEUE_RING_CAPACITY,
+				__ATOMIC_RELEASE);
+	      return 1;
+	    }
+	}
+      else if (dif < 0)
+	return 0;
+      else
+	pos = __atomic_load_n (&q->dequeue_pos, __ATOMIC_RELAXED);
+    }
+}
+
+struct queue *
+make_queue ()
+{
+  struct queue *q;
+  if (posix_memalign ((void **) &q, 64, sizeof (struct queue)) != 0)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      return NULL;
+    }
+  q->enqueue_pos = 0;
+  q->dequeue_pos = 0;
+  q->not_full.word = q->not_full.waiters = 0;
+  q->not_empty.word = q->not_empty.waiters = 0;
+  q->closed = 0;
+  for (size_t i = 0; i < QUEUE_RING_CAPACITY; i++)
+    {
+      q->cells[i].seq = i;
+      q->cells[i].item = NULL;
+    }
+  return q;
+}
+
+static int
+is_closed (struct queue *q)
+{
+  return __atomic_load_n (&q->closed, __ATOMIC_SEQ_CST);
+}
+
+void
+enqueue (struct queue *q, void *item)
+{
+  if (!q)
+    return;
+  if (is_closed (q))
+    {
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+  while (!try_push (q, item))
+    {
+      // A producer blocked on a full queue has nowhere to go once it's
+      // closed, so its item is dropped like any other enqueue after close.
+      if (is_closed (q))
+	{
+	  fprintf (stderr, "Enqueue to a closed queue.\n");
+	  return;
+	}
+      // Full. Register as a waiter before the last check, so that a
+      // dequeue that makes room after the check is sure to see us.
+      unsigned word = register_waiter (&q->not_full);
+      if (try_push (q, item))
+	{
+	  __atomic_sub_fetch (&q->not_full.waiters, 1, __ATOMIC_SEQ_CST);
+	  break;
+	}
+      if (!is_closed (q))
+	futex_wait (&q->not_full.word, word, NULL);
+      __atomic_sub_fetch (&q->not_full.waiters, 1, __ATOMIC_SEQ_CST);
+    }
+  signal_waitpoint (&q->not_empty);
+}
+
+// dequeue and dequeue_timed. abs_timeout may be NULL, to wait forever.
+static void *
+dequeue_until (struct queue *q, const struct timespec *abs_timeout)
+{
+  void *item;
+  while (!try_pop (q, &item))
+    {
+      // Items enqueued before the close are still delivered: we only
+      // get here if there weren't any left.
+      if (is_closed (q))
+	return QUEUE_CLOSED;
+      unsigned word = register_waiter (&q->not_empty);
+      if (try_pop (q, &item))
+	{
+	  __atomic_sub_fetch (&q->not_empty.waiters, 1, __ATOMIC_SEQ_CST);
+	  break;
+	}
+      int woken = is_closed (q)
+	|| futex_wait (&q->not_empty.word, word, abs_timeout);
+      __atomic_sub_fetch (&q->not_empty.waiters, 1, __ATOMIC_SEQ_CST);
+      if (!woken)
+	return QUEUE_EMPTY;
+    }
+  signal_waitpoint (&q->not_full);
+  return item;
+}
+
+void *
+dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  return dequeue_until (q, NULL);
+}
+
+void *
+try_dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  void *item;
+  if (!try_pop (q, &item))
+    return is_closed (q) ? QUEUE_CLOSED : QUEUE_EMPTY;
+  signal_waitpoint (&q->not_full);
+  return item;
+}
+
+void *
+dequeue_timed (struct queue *q, const struct timespec *abs_timeout)
+{
+  if (!q)
+    return NULL;
+  return dequeue_until (q, abs_timeout);
+}
+
+void
+queue_close (struct queue *q)
+{
+  if (!q)
+    return;
+  if (__atomic_exchange_n (&q->closed, 1, __ATOMIC_SEQ_CST))
+    return;
+  // Wake everyone, on both sides, to notice.
+  __atomic_add_fetch (&q->not_empty.word, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&q->not_full.word, 1, __ATOMIC_SEQ_CST);
+  futex_wake (&q->not_empty.word, INT_MAX);
+  futex_wake (&q->not_full.word, INT_MAX);
+}
+
+// This variant can't be polled: see queue_eventfd.c.
+int
+queue_fd (struct queue *q)
+{
+  (void) q;
+  return -1;
+}
+
+// The ring has no lock to amortize: the batch operations are here for
+// compatibility with the other variants.
+void
+enqueue_many (struct queue *q, void **items, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    enqueue (q, items[i]);
+}
+
+size_t
+dequeue_up_to (struct queue *q, void **out, size_t max)
+{
+  if (!q || max == 0)
+    return 0;
+  out[0] = dequeue (q);
+  if (out[0] == QUEUE_CLOSED)
+    return 0;
+  size_t n = 1;
+  while (n < max && try_pop (q, &out[n]))
+    {
+      n++;
+      signal_waitpoint (&q->not_full);
+    }
+  return n;
+}
+
+void
+destroy_queue (struct queue *q)
+{
+  // The items are the user's, and there are no nodes.
+  free (q);
+}
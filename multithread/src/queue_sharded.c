@@ -0,0 +1,317 @@
+/* queue_sharded.c */
+// Sharded variant of the synchronized queue: build with `make QUEUE=sharded`.
+//
+// The queue is split into shards, each an array of items used as a ring,
+// with its own lock. Every thread has a home shard. enqueue always adds to
+// the caller's home shard. dequeue tries the caller's home shard first and
+// then the others in turn. So when producers and consumers are spread over
+// the shards, they mostly take different locks, where queue.c has all of
+// them take the same one.
+//
+// What's given up is global FIFO order. Items enqueued by one thread are
+// dequeued in the order it enqueued them. (A single thread that enqueues
+// and dequeues sees a plain FIFO queue.) But items from different threads
+// can come out in any order, regardless of when they were enqueued.
+//
+// Blocking still goes through a single semaphore that counts the items, as
+// in queue.c. Unlike the mutex, it's only a system call when someone has
+// to sleep, and otherwise an atomic add, so it isn't held while anyone
+// works on a shard.
+#define _POSIX_C_SOURCE 200809L	// sem_timedwait, sysconf
+#include "queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Number of shards, or 0 for one per online CPU, with at least
+// QUEUE_MIN_SHARDS so that there's some spreading on small machines too.
+#ifndef QUEUE_SHARDS
+#define QUEUE_SHARDS 0
+#endif
+#define QUEUE_MIN_SHARDS 4
+#define SHARD_INITIAL_CAPACITY 64
+
+struct shard
+{
+  pthread_mutex_t lock;
+  void **items;
+  size_t head;
+  // Read without the lock to skip empty shards.
+  size_t count;
+  size_t capacity;
+} __attribute__ ((aligned (64)));
+
+struct queue
+{
+  // Counts the items, plus one once the queue is closed, as in queue.c.
+  sem_t items;
+  int closed;
+  size_t n_shards;
+  struct shard *shards;
+};
+
+// Every thread gets a number the first time it uses a queue; its home
+// shard in a queue with n shards is that number mod n. Numbers are handed
+// out in order, so threads are spread evenly.
+static size_t next_thread_slot;
+static __thread size_t thread_slot = (size_t) -1;
+
+static size_t
+home_shard (struct queue *q)
+{
+  if (thread_slot == (size_t) -1)
+    thread_slot = __atomic_fetch_add (&next_thread_slot, 1, __ATOMIC_RELAXED);
+  return thread_slot % q->n_shards;
+}
+
+// The caller must hold s->lock, as for shard_pop.
+static int
+shard_push (struct shard *s, void *item)
+{
+  if (s->count == s->capacity)
+    {
+      size_t capacity = s->capacity ? 2 * s->capacity
+	: SHARD_INITIAL_CAPACITY;
+      void **items = malloc (capacity * sizeof (void *));
+      if (!items)
+	return 0;
+      // Unwrap the ring into the new array.
+      for (size_t i = 0; i < s->count; i++)
+	items[i] = s->items[(s->head + i) % s->capacity];
+      free (s->items);
+      s->items = items;
+      s->head = 0;
+      s->capacity = capacity;
+    }
+  s->items[(s->head + s->count) % s->capacity] = item;
+  __atomic_store_n (&s->count, s->count + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// s must not be empty.
+static void *
+shard_pop (struct shard *s)
+{
+  void *item = s->items[s->head];
+  s->head = (s->head + 1) % s->capacity;
+  __atomic_store_n (&s->count, s->count - 1, __ATOMIC_RELAXED);
+  return item;
+}
+
+struct queue *
+make_queue ()
+{
+  size_t n_shards = QUEUE_SHARDS;
+  if (n_shards == 0)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      n_shards = cpus > QUEUE_MIN_SHARDS ? cpus : QUEUE_MIN_SHARDS;
+    }
+
+  struct queue *q = malloc (sizeof (struct queue));
+  if (!q)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      return NULL;
+    }
+  if (posix_memalign ((void **) &q->shards, 64,
+		      n_shards * sizeof (struct shard)) != 0)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      free (q);
+      return NULL;
+    }
+  if (sem_init (&q->items, 0, 0) != 0)
+    {
+      fprintf (stderr, "Failed to initialize semaphore.\n");
+      free (q->shards);
+      free (q);
+      return NULL;
+    }
+  q->closed = 0;
+  q->n_shards = n_shards;
+  for (size_t i = 0; i < n_shards; i++)
+    {
+      pthread_mutex_init (&q->shards[i].lock, NULL);
+      q->shards[i].items = NULL;
+      q->shards[i].head = 0;
+      q->shards[i].count = 0;
+      q->shards[i].capacity = 0;
+    }
+  return q;
+}
+
+static int
+is_closed (struct queue *q)
+{
+  return __atomic_load_n (&q->closed, __ATOMIC_SEQ_CST);
+}
+
+void
+enqueue (struct queue *q, void *item)
+{
+  enqueue_many (q, &item, 1);
+}
+
+void
+enqueue_many (struct queue *q, void **items, size_t n)
+{
+  if (!q || n == 0)
+    return;
+  if (is_closed (q))
+    {
+      fprintf (stderr, "Enqueue to a closed queue.\n");
+      return;
+    }
+  struct shard *s = &q->shards[home_shard (q)];
+  pthread_mutex_lock (&s->lock);
+  size_t pushed;
+  for (pushed = 0; pushed < n; pushed++)
+    {
+      if (!shard_push (s, items[pushed]))
+	{
+	  fprintf (stderr, "Failed to grow shard.\n");
+	  break;
+	}
+    }
+  pthread_mutex_unlock (&s->lock);
+  for (size_t i = 0; i < pushed; i++)
+    sem_post (&q->items);
+}
+
+// Remove an item, having claimed a count from q->items. Returns
+// QUEUE_CLOSED if there wasn't one, which only happens when we claimed the
+// count that queue_close posted.
+static void *
+take_any (struct queue *q)
+{
+  size_t home = home_shard (q);
+  // First look only at shards that seem to have something...
+  for (size_t i = 0; i < q->n_shards; i++)
+    {
+      struct shard *s = &q->shards[(home + i) % q->n_shards];
+      if (__atomic_load_n (&s->count, __ATOMIC_RELAXED) == 0)
+	continue;
+      pthread_mutex_lock (&s->lock);
+      if (s->count)
+	{
+	  void *item = shard_pop (s);
+	  pthread_mutex_unlock (&s->lock);
+	  return item;
+	}
+      pthread_mutex_unlock (&s->lock);
+    }
+  // ...then, since other consumers may have taken those, look at every one
+  // under its lock. Each count claimed, other than the closing one, stands
+  // for an item in some shard, so this finds one unless the queue is
+  // closed and empty.
+  while (1)
+    {
+      for (size_t i = 0; i < q->n_shards; i++)
+	{
+	  struct shard *s = &q->shards[(home + i) % q->n_shards];
+	  pthread_mutex_lock (&s->lock);
+	  if (s->count)
+	    {
+	      void *item = shard_pop (s);
+	      pthread_mutex_unlock (&s->lock);
+	      return item;
+	    }
+	  pthread_mutex_unlock (&s->lock);
+	}
+      if (is_closed (q))
+	{
+	  // Pass the closing count on.
+	  sem_post (&q->items);
+	  return QUEUE_CLOSED;
+	}
+    }
+}
+
+void *
+dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  while (sem_wait (&q->items) != 0)
+    ;
+  return take_any (q);
+}
+
+void *
+try_dequeue (struct queue *q)
+{
+  if (!q)
+    return NULL;
+  if (sem_trywait (&q->items) == 0)
+    return take_any (q);
+  return is_closed (q) ? QUEUE_CLOSED : QUEUE_EMPTY;
+}
+
+void *
+dequeue_timed (struct queue *q, const struct timespec *abs_timeout)
+{
+  if (!q)
+    return NULL;
+  while (sem_timedwait (&q->items, abs_timeout) != 0)
+    {
+      if (errno != EINTR)
+	return QUEUE_EMPTY;
+    }
+  return take_any (q);
+}
+
+void
+queue_close (struct queue *q)
+{
+  if (!q)
+    return;
+  if (!__atomic_exchange_n (&q->closed, 1, __ATOMIC_SEQ_CST))
+    sem_post (&q->items);
+}
+
+// This variant can't be polled: see queue_eventfd.c.
+int
+queue_fd (struct queue *q)
+{
+  (void) q;
+  return -1;
+}
+
+size_t
+dequeue_up_to (struct queue *q, void **out, size_t max)
+{
+  if (!q || max == 0)
+    return 0;
+  while (sem_wait (&q->items) != 0)
+    ;
+  size_t n = 0;
+  do
+    {
+      out[n] = take_any (q);
+      if (out[n] == QUEUE_CLOSED)
+	break;
+      n++;
+    }
+  while (n < max && sem_trywait (&q->items) == 0);
+  return n;
+}
+
+void
+destroy_queue (struct queue *q)
+{
+  if (!q)
+    return;
+  // The items are the user's.
+  for (size_t i = 0; i < q->n_shards; i++)
+    {
+      pthread_mutex_destroy (&q->shards[i].lock);
+      free (q->shards[i].items);
+    }
+  sem_destroy (&q->items);
+  free (q->shards);
+  free (q);
+}
@@ -0,0 +1,257 @@
+/* shm_queue.c */
+#define _POSIX_C_SOURCE 200809L	// robust mutexes
+#include "shm_queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_QUEUE_MAGIC 0x53484d51	// "SHMQ"
+
+// The start of the segment. Items follow it, at data_offset. Positions are
+// indices into the items, never pointers, since every process maps the
+// segment at a different address.
+struct shm_header
+{
+  // Set last by shm_queue_create, so a process that opens the segment
+  // early doesn't use it half-initialized.
+  uint32_t magic;
+  size_t capacity;
+  size_t item_size;
+  size_t data_offset;
+  size_t segment_size;
+  pthread_mutex_t lock;
+  // Filled slots, and free slots. Each gets one extra count when the queue
+  // is closed, passed on from waiter to waiter as in queue.c.
+  sem_t items;
+  sem_t slots;
+  // Protected by lock.
+  size_t head;
+  size_t count;
+  int closed;
+};
+
+// This process's view of the queue.
+struct shm_queue
+{
+  struct shm_header *header;
+  unsigned char *data;
+};
+
+static struct shm_queue *
+attach (struct shm_header *header)
+{
+  struct shm_queue *q = malloc (sizeof (struct shm_queue));
+  if (!q)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      munmap (header, header->segment_size);
+      return NULL;
+    }
+  q->header = header;
+  q->data = (unsigned char *) header + header->data_offset;
+  return q;
+}
+
+struct shm_queue *
+shm_queue_create (const char *name, size_t capacity, size_t item_size)
+{
+  if (capacity == 0 || item_size == 0)
+    return NULL;
+  size_t data_offset = (sizeof (struct shm_header) + 63) & ~(size_t) 63;
+  size_t segment_size = data_offset + capacity * item_size;
+
+  int fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    {
+      perror ("shm_open");
+      return NULL;
+    }
+  if (ftruncate (fd, segment_size) != 0)
+    {
+      perror ("ftruncate");
+      close (fd);
+      shm_unlink (name);
+      return NULL;
+    }
+  struct shm_header *h = mmap (NULL, segment_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, fd, 0);
+  close (fd);
+  if (h == MAP_FAILED)
+    {
+      perror ("mmap");
+      shm_unlink (name);
+      return NULL;
+    }
+
+  h->capacity = capacity;
+  h->item_size = item_size;
+  h->data_offset = data_offset;
+  h->segment_size = segment_size;
+  h->head = 0;
+  h->count = 0;
+  h->closed = 0;
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+  int failed = pthread_mutex_init (&h->lock, &attr) != 0;
+  pthread_mutexattr_destroy (&attr);
+  failed = failed || sem_init (&h->items, 1, 0) != 0
+    || sem_init (&h->slots, 1, capacity) != 0;
+  if (failed)
+    {
+      fprintf (stderr, "Failed to initialize shared queue.\n");
+      munmap (h, segment_size);
+      shm_unlink (name);
+      return NULL;
+    }
+
+  __atomic_store_n (&h->magic, SHM_QUEUE_MAGIC, __ATOMIC_RELEASE);
+  return attach (h);
+}
+
+struct shm_queue *
+shm_queue_open (const char *name)
+{
+  int fd = shm_open (name, O_RDWR, 0);
+  if (fd < 0)
+    {
+      perror ("shm_open");
+      return NULL;
+    }
+  struct stat st;
+  if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (struct shm_header))
+    {
+      fprintf (stderr, "Not a shared queue: %s\n", name);
+      close (fd);
+      return NULL;
+    }
+  struct shm_header *h = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, fd, 0);
+  close (fd);
+  if (h == MAP_FAILED)
+    {
+      perror ("mmap");
+      return NULL;
+    }
+  if (__atomic_load_n (&h->magic, __ATOMIC_ACQUIRE) != SHM_QUEUE_MAGIC
+      || h->segment_size != (size_t) st.st_size)
+    {
+      fprintf (stderr, "Not a shared queue: %s\n", name);
+      munmap (h, st.st_size);
+      return NULL;
+    }
+  return attach (h);
+}
+
+size_t
+shm_queue_item_size (struct shm_queue *q)
+{
+  return q->header->item_size;
+}
+
+// Lock the queue. If the last holder died with the lock, the positions
+// are still consistent (they're only written after the copy they cover),
+// so mark the lock usable again and carry on.
+static void
+lock_queue (struct shm_header *h)
+{
+  if (pthread_mutex_lock (&h->lock) == EOWNERDEAD)
+    pthread_mutex_consistent (&h->lock);
+}
+
+static void
+wait_on (sem_t *sem)
+{
+  while (sem_wait (sem) != 0 && errno == EINTR)
+    ;
+}
+
+int
+shm_enqueue (struct shm_queue *q, const void *item)
+{
+  if (!q)
+    return -1;
+  struct shm_header *h = q->header;
+  wait_on (&h->slots);
+  lock_queue (h);
+  if (h->closed)
+    {
+      pthread_mutex_unlock (&h->lock);
+      // Give the slot, or the closing count, to the next producer.
+      sem_post (&h->slots);
+      return -1;
+    }
+  size_t tail = (h->head + h->count) % h->capacity;
+  memcpy (q->data + tail * h->item_size, item, h->item_size);
+  h->count++;
+  pthread_mutex_unlock (&h->lock);
+  sem_post (&h->items);
+  return 0;
+}
+
+int
+shm_dequeue (struct shm_queue *q, void *out)
+{
+  if (!q)
+    return -1;
+  struct shm_header *h = q->header;
+  wait_on (&h->items);
+  lock_queue (h);
+  if (h->count == 0)
+    {
+      // We claimed the count that shm_queue_close posted; pass it on.
+      pthread_mutex_unlock (&h->lock);
+      sem_post (&h->items);
+      return -1;
+    }
+  memcpy (out, q->data + h->head * h->item_size, h->item_size);
+  h->head = (h->head + 1) % h->capacity;
+  h->count--;
+  pthread_mutex_unlock (&h->lock);
+  sem_post (&h->slots);
+  return 0;
+}
+
+void
+shm_queue_close (struct shm_queue *q)
+{
+  if (!q)
+    return;
+  struct shm_header *h = q->header;
+  lock_queue (h);
+  int was_closed = h->closed;
+  h->closed = 1;
+  pthread_mutex_unlock (&h->lock);
+  if (!was_closed)
+    {
+      // Wake a consumer waiting on an empty queue, and a producer waiting
+      // on a full one.
+      sem_post (&h->items);
+      sem_post (&h->slots);
+    }
+}
+
+void
+shm_queue_detach (struct shm_queue *q)
+{
+  if (!q)
+    return;
+  munmap (q->header, q->header->segment_size);
+  free (q);
+}
+
+int
+shm_queue_unlink (const char *name)
+{
+  return shm_unlink (name);
+}
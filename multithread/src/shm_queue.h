@@ -0,0 +1,44 @@
+/* shm_queue.h */
+#ifndef SHM_QUEUE_H
+#define SHM_QUEUE_H
+
+#include <stddef.h>
+
+// A bounded queue in a named POSIX shared memory segment, for passing work
+// between processes: one creates it, any number open it by name, and all of
+// them can enqueue and dequeue.
+//
+// Pointers mean nothing in another process, so items are copied in and out
+// of the segment: every item is item_size bytes, fixed when the queue is
+// created. The lock and semaphores live in the segment too, and are
+// process-shared. The lock is robust, so a process that dies while holding
+// it doesn't hang the others.
+//
+// Closing works as for queue.h: after shm_queue_close, enqueue fails, and
+// dequeue fails once the items left have been taken.
+struct shm_queue;
+
+// Create a segment called name (which starts with '/', as for shm_open)
+// holding an empty queue of capacity items of item_size bytes each. Fails,
+// returning NULL, if the name is already taken.
+struct shm_queue *shm_queue_create (const char *name, size_t capacity,
+				    size_t item_size);
+// Map a queue that another process created.
+struct shm_queue *shm_queue_open (const char *name);
+// Size of the queue's items.
+size_t shm_queue_item_size (struct shm_queue *q);
+// Copy item_size bytes from item into the queue, waiting while it's full.
+// Returns 0, or -1 if the queue is closed.
+int shm_enqueue (struct shm_queue *q, const void *item);
+// Copy the oldest item into out, waiting while the queue is empty. Returns
+// 0, or -1 if the queue is closed and empty.
+int shm_dequeue (struct shm_queue *q, void *out);
+// Close the queue, for every process using it.
+void shm_queue_close (struct shm_queue *q);
+// Unmap the queue from this process. The segment stays until it's unlinked
+// and every process has detached.
+void shm_queue_detach (struct shm_queue *q);
+// Remove the segment's name, so it can't be opened any more.
+int shm_queue_unlink (const char *name);
+
+#endif // SHM_QUEUE_H
@@ -0,0 +1,176 @@
+/* spsc.c */
+#define _GNU_SOURCE		// syscall
+#include "spsc.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct spsc_queue
+{
+  // The consumer's line: the next position to read, and the last tail it
+  // saw, so that it only reads the producer's line when it seems empty.
+  size_t head __attribute__ ((aligned (64)));
+  size_t cached_tail;
+  // The producer's line, the other way around.
+  size_t tail __attribute__ ((aligned (64)));
+  size_t cached_head;
+  // Set by a side that's about to sleep: the consumer on empty, the
+  // producer on full. Used as futex words.
+  unsigned consumer_parked __attribute__ ((aligned (64)));
+  unsigned producer_parked;
+  // Read-only after make_spsc_queue.
+  int parking __attribute__ ((aligned (64)));
+  size_t mask;
+  void **items;
+};
+
+static void
+futex_wait (unsigned *word, unsigned expected)
+{
+  syscall (SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void
+futex_wake (unsigned *word)
+{
+  syscall (SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+struct spsc_queue *
+make_spsc_queue (size_t capacity, int parking)
+{
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+
+  struct spsc_queue *q;
+  if (posix_memalign ((void **) &q, 64, sizeof (struct spsc_queue)) != 0)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      return NULL;
+    }
+  q->items = malloc (size * sizeof (void *));
+  if (!q->items)
+    {
+      fprintf (stderr, "Failed to allocate queue.\n");
+      free (q);
+      return NULL;
+    }
+  q->head = q->cached_tail = 0;
+  q->tail = q->cached_head = 0;
+  q->consumer_parked = q->producer_parked = 0;
+  q->parking = parking;
+  q->mask = size - 1;
+  return q;
+}
+
+// Wake the other side if it's parked on word. Only called in parking mode.
+static void
+unpark (unsigned *word)
+{
+  // Pairs with the fence in park: either we see the flag, or the other
+  // side's last check sees what we just did.
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (__atomic_load_n (word, __ATOMIC_RELAXED))
+    {
+      __atomic_store_n (word, 0, __ATOMIC_RELAXED);
+      futex_wake (word);
+    }
+}
+
+// Sleep on word unless ready() (checked after raising the flag) says
+// there's no need to.
+static void
+park (struct spsc_queue *q, unsigned *word,
+      int (*ready) (struct spsc_queue *))
+{
+  __atomic_store_n (word, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  if (!ready (q))
+    futex_wait (word, 1);
+  __atomic_store_n (word, 0, __ATOMIC_RELAXED);
+}
+
+int
+spsc_try_enqueue (struct spsc_queue *q, void *item)
+{
+  size_t tail = q->tail;
+  if (tail - q->cached_head > q->mask)
+    {
+      q->cached_head = __atomic_load_n (&q->head, __ATOMIC_ACQUIRE);
+      if (tail - q->cached_head > q->mask)
+	return 0;
+    }
+  q->items[tail & q->mask] = item;
+  __atomic_store_n (&q->tail, tail + 1, __ATOMIC_RELEASE);
+  if (q->parking)
+    unpark (&q->consumer_parked);
+  return 1;
+}
+
+void *
+spsc_try_dequeue (struct spsc_queue *q)
+{
+  size_t head = q->head;
+  if (head == q->cached_tail)
+    {
+      q->cached_tail = __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+      if (head == q->cached_tail)
+	return QUEUE_EMPTY;
+    }
+  void *item = q->items[head & q->mask];
+  __atomic_store_n (&q->head, head + 1, __ATOMIC_RELEASE);
+  if (q->parking)
+    unpark (&q->producer_parked);
+  return item;
+}
+
+static int
+has_room (struct spsc_queue *q)
+{
+  return q->tail - __atomic_load_n (&q->head, __ATOMIC_ACQUIRE) <= q->mask;
+}
+
+static int
+has_items (struct spsc_queue *q)
+{
+  return q->head != __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+}
+
+void
+spsc_enqueue (struct spsc_queue *q, void *item)
+{
+  while (!spsc_try_enqueue (q, item))
+    {
+      if (q->parking)
+	park (q, &q->producer_parked, has_room);
+      else
+	sched_yield ();
+    }
+}
+
+void *
+spsc_dequeue (struct spsc_queue *q)
+{
+  void *item;
+  while ((item = spsc_try_dequeue (q)) == QUEUE_EMPTY)
+    {
+      if (q->parking)
+	park (q, &q->consumer_parked, has_items);
+      else
+	sched_yield ();
+    }
+  return item;
+}
+
+void
+destroy_spsc_queue (struct spsc_queue *q)
+{
+  if (!q)
+    return;
+  free (q->items);
+  free (q);
+}
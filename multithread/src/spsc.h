@@ -0,0 +1,40 @@
+/* spsc.h */
+#ifndef SPSC_H
+#define SPSC_H
+
+#include "queue.h"		// QUEUE_EMPTY
+#include <stddef.h>
+
+// A bounded queue for exactly one producer thread and one consumer thread.
+//
+// The producer only writes the tail index and the consumer only writes the
+// head index, each on its own cache line, so the try functions are
+// wait-free and use nothing but acquire loads and release stores: no locks
+// and no read-modify-write instructions.
+//
+// spsc_enqueue and spsc_dequeue wait while the queue is full (or empty).
+// How they wait depends on the queue's mode. Without parking they spin,
+// yielding the CPU between attempts. With parking they sleep on a futex,
+// which costs each enqueue and dequeue a memory fence to check whether
+// the other side is asleep, but nothing else.
+//
+// Nothing checks that there's only one producer and one consumer: with
+// more, items are lost or duplicated.
+struct spsc_queue;
+
+// Allocate an empty queue with room for capacity items (rounded up to a
+// power of two). parking chooses how spsc_enqueue and spsc_dequeue wait.
+// Returns NULL on failure.
+struct spsc_queue *make_spsc_queue (size_t capacity, int parking);
+// Add item, unless the queue is full. Returns 1 if it was added.
+int spsc_try_enqueue (struct spsc_queue *q, void *item);
+// Remove the oldest item, or return QUEUE_EMPTY.
+void *spsc_try_dequeue (struct spsc_queue *q);
+// Add item, waiting while the queue is full.
+void spsc_enqueue (struct spsc_queue *q, void *item);
+// Remove the oldest item, waiting while the queue is empty.
+void *spsc_dequeue (struct spsc_queue *q);
+// Free the queue. The items are the caller's.
+void destroy_spsc_queue (struct spsc_queue *q);
+
+#endif // SPSC_H
@@ -0,0 +1,98 @@
+/* spsc_bench.c */
+// Throughput of one producer and one consumer passing items through the
+// SPSC queue, in both of its modes, and through the general queue built
+// with this binary (`make QUEUE=<variant> spsc_bench`). Output is CSV:
+// queue,ops_per_sec, where each item enqueued and each item dequeued is
+// one op.
+#define _POSIX_C_SOURCE 200809L	// clock_gettime
+#include "queue.h"
+#include "spsc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef QUEUE_VARIANT
+#define QUEUE_VARIANT "mutex"
+#endif
+
+#define DEFAULT_ITEMS 1000000
+#define SPSC_CAPACITY 1024
+
+long items;
+struct spsc_queue *sq = NULL;
+struct queue *q = NULL;
+
+void *
+spsc_producer (void *arg)
+{
+  (void) arg;
+  for (intptr_t i = 1; i <= items; ++i)
+    spsc_enqueue (sq, (void *) i);
+  return NULL;
+}
+
+void *
+queue_producer (void *arg)
+{
+  (void) arg;
+  for (intptr_t i = 1; i <= items; ++i)
+    enqueue (q, (void *) i);
+  return NULL;
+}
+
+double
+now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns ops per second.
+double
+run_spsc (int parking)
+{
+  sq = make_spsc_queue (SPSC_CAPACITY, parking);
+  pthread_t producer;
+  double start = now ();
+  pthread_create (&producer, NULL, spsc_producer, NULL);
+  for (long i = 0; i < items; ++i)
+    spsc_dequeue (sq);
+  pthread_join (producer, NULL);
+  double elapsed = now () - start;
+  destroy_spsc_queue (sq);
+  return 2 * items / elapsed;
+}
+
+double
+run_queue ()
+{
+  q = make_queue ();
+  pthread_t producer;
+  double start = now ();
+  pthread_create (&producer, NULL, queue_producer, NULL);
+  for (long i = 0; i < items; ++i)
+    dequeue (q);
+  pthread_join (producer, NULL);
+  double elapsed = now () - start;
+  destroy_queue (q);
+  return 2 * items / elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  items = argc > 1 ? atol (argv[1]) : DEFAULT_ITEMS;
+  if (items <= 0)
+    {
+      fprintf (stderr, "Usage: %s [ITEMS]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  printf ("queue,ops_per_sec\n");
+  printf ("spsc-spinning,%.0f\n", run_spsc (0));
+  printf ("spsc-parking,%.0f\n", run_spsc (1));
+  printf ("%s,%.0f\n", QUEUE_VARIANT, run_queue ());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/* test_pqueue.c */
+#define _POSIX_C_SOURCE 200809L	// nanosleep
+#include "pqueue.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int score = 0;
+#define NUM_THREADS 4
+#define ITEMS_PER_THREAD 10000
+struct pqueue *pq = NULL;
+
+void
+print_result (const char *test_name, int passed)
+{
+  if (passed)
+    {
+      printf ("[PASS] %s\n", test_name);
+      score += 1;
+    }
+  else
+    {
+      printf ("[FAIL] %s\n", test_name);
+    }
+}
+
+void
+test_exact_order ()
+{
+  // With a single heap, pop_min is exact.
+  pq = make_pqueue (1);
+  long priorities[] = { 5, 3, 9, 1, 7, 3, 8, 2, 6, 4 };
+  int n = sizeof (priorities) / sizeof (priorities[0]);
+  for (int i = 0; i < n; ++i)
+    pqueue_push (pq, priorities[i], &priorities[i]);
+  int passed = 1;
+  long last = -1;
+  for (int i = 0; i < n; ++i)
+    {
+      long priority;
+      long *item = pqueue_pop_min (pq, &priority);
+      passed = passed && *item == priority && priority >= last;
+      last = priority;
+    }
+  passed = passed && pqueue_try_pop_min (pq, NULL) == QUEUE_EMPTY;
+  print_result ("Exact Order Test", passed);
+  destroy_pqueue (pq);
+}
+
+void *
+push_thread (void *arg)
+{
+  intptr_t base = (intptr_t) arg;
+  for (intptr_t i = 0; i < ITEMS_PER_THREAD; ++i)
+    {
+      // Priorities are a permutation of the thread's range, so that every
+      // pusher fills in all of the queue's order at once.
+      intptr_t p = base + (i * 7919) % ITEMS_PER_THREAD;
+      pqueue_push (pq, p, (void *) (p + 1));
+    }
+  return NULL;
+}
+
+void *
+pop_thread (void *arg)
+{
+  long *sum = arg;
+  void *item;
+  long priority;
+  while ((item = pqueue_pop_min (pq, &priority)) != QUEUE_CLOSED)
+    if ((intptr_t) item == priority + 1)
+      *sum += priority;
+  return NULL;
+}
+
+void
+test_concurrent_push_pop ()
+{
+  pq = make_pqueue (0);
+  pthread_t pushers[NUM_THREADS], poppers[NUM_THREADS];
+  long sums[NUM_THREADS] = { 0 };
+  for (intptr_t i = 0; i < NUM_THREADS; ++i)
+    {
+      pthread_create (&pushers[i], NULL, push_thread,
+		      (void *) (i * ITEMS_PER_THREAD));
+      pthread_create (&poppers[i], NULL, pop_thread, &sums[i]);
+    }
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_join (pushers[i], NULL);
+  pqueue_close (pq);
+  long sum = 0;
+  for (int i = 0; i < NUM_THREADS; ++i)
+    {
+      pthread_join (poppers[i], NULL);
+      sum += sums[i];
+    }
+  // Every item came out exactly once.
+  long n = (long) NUM_THREADS * ITEMS_PER_THREAD;
+  print_result ("Concurrent Push Pop Test", sum == n * (n - 1) / 2);
+  destroy_pqueue (pq);
+}
+
+void
+test_relaxed_order ()
+{
+  // Many heaps: order is only approximate, but the first items out should
+  // still come from the very front.
+  pq = make_pqueue (8);
+  pthread_t pushers[NUM_THREADS];
+  for (intptr_t i = 0; i < NUM_THREADS; ++i)
+    pthread_create (&pushers[i], NULL, push_thread,
+		    (void *) (i * ITEMS_PER_THREAD));
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_join (pushers[i], NULL);
+  long n = (long) NUM_THREADS * ITEMS_PER_THREAD;
+  int passed = 1;
+  for (int i = 0; i < 100; ++i)
+    {
+      long priority;
+      pqueue_pop_min (pq, &priority);
+      passed = passed && priority < n / 100;
+    }
+  print_result ("Relaxed Order Test", passed);
+  destroy_pqueue (pq);
+}
+
+void *
+closed_popper (void *result)
+{
+  *(void **) result = pqueue_pop_min (pq, NULL);
+  return NULL;
+}
+
+void
+test_close ()
+{
+  pq = make_pqueue (4);
+  pthread_t poppers[NUM_THREADS];
+  void *results[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_create (&poppers[i], NULL, closed_popper, &results[i]);
+  nanosleep (&(struct timespec) {.tv_nsec = 100000000}, NULL);
+  int a = 1;
+  pqueue_push (pq, 0, &a);
+  pqueue_close (pq);
+  // One blocked popper gets the item, and the rest see QUEUE_CLOSED.
+  int got_item = 0, got_closed = 0;
+  for (int i = 0; i < NUM_THREADS; ++i)
+    {
+      pthread_join (poppers[i], NULL);
+      got_item += results[i] == &a;
+      got_closed += results[i] == QUEUE_CLOSED;
+    }
+  int passed = got_item == 1 && got_closed == NUM_THREADS - 1;
+  passed = passed && pqueue_try_pop_min (pq, NULL) == QUEUE_CLOSED;
+  print_result ("Close Test", passed);
+  destroy_pqueue (pq);
+}
+
+int
+main ()
+{
+  test_exact_order ();
+  test_concurrent_push_pop ();
+  test_relaxed_order ();
+  test_close ();
+
+  printf ("Final Score: %d/4\n", score);
+  return 0;
+}
@@ -1,10 +1,13 @@
 /* test_queue.c */
+#define _POSIX_C_SOURCE 200809L	// clock_gettime, nanosleep
 #include "queue.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
 
 int score = 0;
 #define NUM_THREADS 5
@@ -254,6 +257,179 @@ test_unpredictable_order ()
 
 }
 
+void
+test_batch_operations ()
+{
+  q = make_queue ();
+  int v[5];
+  void *items[5], *out[10];
+  for (int i = 0; i < 5; ++i)
+    items[i] = &v[i];
+  enqueue_many (q, items, 5);
+
+  // Asking for fewer than there are gets exactly that many; asking for
+  // more gets what's there, without blocking.
+  size_t first = dequeue_up_to (q, out, 3);
+  size_t second = dequeue_up_to (q, out + 3, 10);
+  int passed = first == 3 && second == 2;
+  for (int i = 0; passed && i < 5; ++i)
+    passed = out[i] == &v[i];
+  print_result ("Batch Enqueue-Dequeue Test", passed);
+  destroy_queue (q);
+}
+
+void
+test_try_and_timed_dequeue ()
+{
+  q = make_queue ();
+  int a = 1;
+  int passed = try_dequeue (q) == QUEUE_EMPTY;
+  enqueue (q, &a);
+  passed = passed && try_dequeue (q) == &a;
+
+  // Nothing arrives, so this should give up after about 100ms.
+  struct timespec deadline, before, after;
+  clock_gettime (CLOCK_MONOTONIC, &before);
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += 100000000;
+  if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  passed = passed && dequeue_timed (q, &deadline) == QUEUE_EMPTY;
+  clock_gettime (CLOCK_MONOTONIC, &after);
+  double waited = (after.tv_sec - before.tv_sec)
+    + (after.tv_nsec - before.tv_nsec) / 1e9;
+  passed = passed && waited >= 0.09;
+
+  enqueue (q, &a);
+  passed = passed && dequeue_timed (q, &deadline) == &a;
+  print_result ("Try and Timed Dequeue Test", passed);
+  destroy_queue (q);
+}
+
+void *
+closed_consumer (void *result)
+{
+  *(void **) result = dequeue (q);
+  return NULL;
+}
+
+void
+test_queue_close ()
+{
+  q = make_queue ();
+  int a = 1;
+  enqueue (q, &a);
+  queue_close (q);
+  // What was enqueued before the close is still delivered...
+  int passed = dequeue (q) == &a;
+
+  // ...and then every consumer, blocked or not, sees QUEUE_CLOSED.
+  pthread_t consumers[NUM_THREADS];
+  void *results[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_create (&consumers[i], NULL, closed_consumer, &results[i]);
+  for (int i = 0; i < NUM_THREADS; ++i)
+    {
+      pthread_join (consumers[i], NULL);
+      passed = passed && results[i] == QUEUE_CLOSED;
+    }
+  passed = passed && try_dequeue (q) == QUEUE_CLOSED;
+  destroy_queue (q);
+
+  // Closing wakes consumers that were already blocked.
+  q = make_queue ();
+  for (int i = 0; i < NUM_THREADS; ++i)
+    pthread_create (&consumers[i], NULL, closed_consumer, &results[i]);
+  nanosleep (&(struct timespec) {.tv_nsec = 100000000}, NULL);
+  queue_close (q);
+  for (int i = 0; i < NUM_THREADS; ++i)
+    {
+      pthread_join (consumers[i], NULL);
+      passed = passed && results[i] == QUEUE_CLOSED;
+    }
+  print_result ("Queue Close Test", passed);
+  destroy_queue (q);
+}
+
+int
+readable (int fd)
+{
+  struct pollfd pfd = {.fd = fd,.events = POLLIN };
+  return poll (&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+void
+test_queue_fd ()
+{
+  q = make_queue ();
+  int fd = queue_fd (q);
+  int passed = 1;
+  // Variants without a descriptor have nothing more to check.
+  if (fd >= 0)
+    {
+      int a = 1, b = 2;
+      passed = !readable (fd);
+      enqueue (q, &a);
+      enqueue (q, &b);
+      passed = passed && readable (fd);
+      passed = passed && try_dequeue (q) == &a && readable (fd);
+      passed = passed && try_dequeue (q) == &b && !readable (fd);
+      // A closed queue stays readable, so pollers come and see it's closed.
+      queue_close (q);
+      passed = passed && readable (fd) && try_dequeue (q) == QUEUE_CLOSED;
+      passed = passed && readable (fd);
+    }
+  print_result ("Queue Fd Test", passed);
+  destroy_queue (q);
+}
+
+#ifdef QUEUE_STATS
+void *
+late_producer (void *item)
+{
+  nanosleep (&(struct timespec) {.tv_nsec = 50000000}, NULL);
+  enqueue (q, item);
+  return NULL;
+}
+
+void
+test_queue_stats ()
+{
+  q = make_queue ();
+  int v[4];
+  for (int i = 0; i < 4; ++i)
+    enqueue (q, &v[i]);
+  for (int i = 0; i < 3; ++i)
+    dequeue (q);
+  // One dequeue that has to wait for its item.
+  pthread_t producer;
+  pthread_create (&producer, NULL, late_producer, &v[0]);
+  dequeue (q);
+  dequeue (q);
+  pthread_join (producer, NULL);
+
+  struct queue_stats stats;
+  queue_stats (q, &stats);
+  int passed = stats.enqueued == 5 && stats.dequeued == 5
+    && stats.depth == 0 && stats.peak_depth == 4;
+  // Each enqueue and dequeue takes the lock once.
+  passed = passed && stats.lock_acquisitions == 10
+    && stats.contended_acquisitions <= stats.lock_acquisitions;
+  passed = passed && stats.blocked_waits == 1
+    && stats.blocked_ns >= 10000000;
+  passed = passed && stats.elapsed > 0 && stats.enqueue_rate > 0;
+  print_result ("Queue Stats Test", passed);
+  destroy_queue (q);
+}
+
+#define NUM_TESTS 15
+#else
+#define NUM_TESTS 14
+#endif
+
 int
 main ()
 {
@@ -267,7 +443,14 @@ main ()
   test_queue_destruction ();
   test_high_load ();
   test_unpredictable_order ();
+  test_batch_operations ();
+  test_try_and_timed_dequeue ();
+  test_queue_close ();
+  test_queue_fd ();
+#ifdef QUEUE_STATS
+  test_queue_stats ();
+#endif
 
-  printf ("Final Score: %d/10\n", score);
+  printf ("Final Score: %d/%d\n", score, NUM_TESTS);
   return 0;
 }
@@ -0,0 +1,177 @@
+/* test_shm_queue.c */
+#define _POSIX_C_SOURCE 200809L	// fork, waitpid
+#include "shm_queue.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int score = 0;
+#define NUM_CONSUMERS 3
+#define NUM_ITEMS 10000
+
+// What's passed between processes: fixed size, no pointers.
+struct work
+{
+  long seq;
+  char text[32];
+};
+
+char queue_name[64];
+char results_name[64];
+
+void
+print_result (const char *test_name, int passed)
+{
+  if (passed)
+    {
+      printf ("[PASS] %s\n", test_name);
+      score += 1;
+    }
+  else
+    {
+      printf ("[FAIL] %s\n", test_name);
+    }
+}
+
+// In a child: take every item, checking they arrive in order, and exit
+// with 0 if they all did. Children leave with _exit, so that they don't
+// flush copies of the parent's buffered output.
+void
+ordered_consumer ()
+{
+  struct shm_queue *q = shm_queue_open (queue_name);
+  if (!q)
+    _exit (2);
+  struct work w;
+  long expected = 0;
+  char text[32];
+  while (shm_dequeue (q, &w) == 0)
+    {
+      snprintf (text, sizeof (text), "item %ld", expected);
+      if (w.seq != expected++ || strcmp (w.text, text) != 0)
+	_exit (1);
+    }
+  shm_queue_detach (q);
+  _exit (expected == NUM_ITEMS ? 0 : 1);
+}
+
+void
+test_cross_process_order ()
+{
+  // A small queue, so the producer keeps waiting for the consumer.
+  struct shm_queue *q =
+    shm_queue_create (queue_name, 8, sizeof (struct work));
+  int passed = q != NULL && shm_queue_item_size (q) == sizeof (struct work);
+  pid_t child = fork ();
+  if (child == 0)
+    ordered_consumer ();
+  for (long i = 0; passed && i < NUM_ITEMS; ++i)
+    {
+      struct work w = {.seq = i };
+      snprintf (w.text, sizeof (w.text), "item %ld", i);
+      passed = shm_enqueue (q, &w) == 0;
+    }
+  shm_queue_close (q);
+  int status;
+  waitpid (child, &status, 0);
+  passed = passed && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+  shm_queue_detach (q);
+  shm_queue_unlink (queue_name);
+  print_result ("Cross-Process Order Test", passed);
+}
+
+// In a child: sum the items taken, and report the sum on the results
+// queue.
+void
+summing_consumer ()
+{
+  struct shm_queue *q = shm_queue_open (queue_name);
+  struct shm_queue *results = shm_queue_open (results_name);
+  if (!q || !results)
+    _exit (2);
+  struct work w;
+  long sum = 0;
+  while (shm_dequeue (q, &w) == 0)
+    sum += w.seq;
+  shm_enqueue (results, &sum);
+  shm_queue_detach (q);
+  shm_queue_detach (results);
+  _exit (0);
+}
+
+void
+test_multiple_consumer_processes ()
+{
+  struct shm_queue *q =
+    shm_queue_create (queue_name, 64, sizeof (struct work));
+  struct shm_queue *results =
+    shm_queue_create (results_name, NUM_CONSUMERS, sizeof (long));
+  pid_t children[NUM_CONSUMERS];
+  for (int i = 0; i < NUM_CONSUMERS; ++i)
+    if ((children[i] = fork ()) == 0)
+      summing_consumer ();
+  for (long i = 1; i <= NUM_ITEMS; ++i)
+    {
+      struct work w = {.seq = i };
+      shm_enqueue (q, &w);
+    }
+  shm_queue_close (q);
+  // Every item was taken by exactly one process.
+  long total = 0;
+  for (int i = 0; i < NUM_CONSUMERS; ++i)
+    {
+      long sum;
+      if (shm_dequeue (results, &sum) == 0)
+	total += sum;
+    }
+  for (int i = 0; i < NUM_CONSUMERS; ++i)
+    waitpid (children[i], NULL, 0);
+  shm_queue_detach (q);
+  shm_queue_detach (results);
+  shm_queue_unlink (queue_name);
+  shm_queue_unlink (results_name);
+  print_result ("Multiple Consumer Processes Test",
+		total == (long) NUM_ITEMS * (NUM_ITEMS + 1) / 2);
+}
+
+void
+test_close ()
+{
+  struct shm_queue *q = shm_queue_create (queue_name, 4, sizeof (long));
+  long a = 1, out = 0;
+  int passed = shm_queue_create (queue_name, 4, sizeof (long)) == NULL;
+  passed = passed && shm_enqueue (q, &a) == 0;
+  shm_queue_close (q);
+  // A second mapping, like another process's, sees the close, but can
+  // still take what's left.
+  struct shm_queue *other = shm_queue_open (queue_name);
+  passed = passed && other && shm_enqueue (other, &a) == -1;
+  passed = passed && shm_dequeue (other, &out) == 0 && out == 1;
+  passed = passed && shm_dequeue (other, &out) == -1;
+  passed = passed && shm_dequeue (q, &out) == -1;
+  shm_queue_detach (other);
+  shm_queue_detach (q);
+  shm_queue_unlink (queue_name);
+  passed = passed && shm_queue_open (queue_name) == NULL;
+  print_result ("Shared Queue Close Test", passed);
+}
+
+int
+main ()
+{
+  snprintf (queue_name, sizeof (queue_name), "/test_shm_queue.%d",
+	    (int) getpid ());
+  snprintf (results_name, sizeof (results_name), "/test_shm_results.%d",
+	    (int) getpid ());
+  // Start from nothing, in case an earlier run was killed.
+  shm_queue_unlink (queue_name);
+  shm_queue_unlink (results_name);
+
+  test_cross_process_order ();
+  test_multiple_consumer_processes ();
+  test_close ();
+
+  printf ("Final Score: %d/3\n", score);
+  return 0;
+}
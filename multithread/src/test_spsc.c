@@ -0,0 +1,119 @@
+/* test_spsc.c */
+#define _POSIX_C_SOURCE 200809L	// nanosleep
+#include "spsc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int score = 0;
+#define NUM_ITEMS 1000000
+struct spsc_queue *q = NULL;
+
+void
+print_result (const char *test_name, int passed)
+{
+  if (passed)
+    {
+      printf ("[PASS] %s\n", test_name);
+      score += 1;
+    }
+  else
+    {
+      printf ("[FAIL] %s\n", test_name);
+    }
+}
+
+void
+test_capacity ()
+{
+  q = make_spsc_queue (5, 0);
+  int v[8];
+  int passed = spsc_try_dequeue (q) == QUEUE_EMPTY;
+  // 5 is rounded up to 8.
+  for (int i = 0; i < 8; ++i)
+    passed = passed && spsc_try_enqueue (q, &v[i]);
+  passed = passed && !spsc_try_enqueue (q, &v[0]);
+  for (int i = 0; i < 8; ++i)
+    passed = passed && spsc_try_dequeue (q) == &v[i];
+  passed = passed && spsc_try_dequeue (q) == QUEUE_EMPTY;
+  print_result ("SPSC Capacity Test", passed);
+  destroy_spsc_queue (q);
+}
+
+void *
+producer_thread (void *arg)
+{
+  (void) arg;
+  for (intptr_t i = 1; i <= NUM_ITEMS; ++i)
+    spsc_enqueue (q, (void *) i);
+  return NULL;
+}
+
+// Passes items through a small queue, so that both sides keep finding it
+// full or empty, and checks they all arrive in order.
+int
+transfer (int parking)
+{
+  q = make_spsc_queue (64, parking);
+  pthread_t producer;
+  pthread_create (&producer, NULL, producer_thread, NULL);
+  int passed = 1;
+  for (intptr_t i = 1; i <= NUM_ITEMS; ++i)
+    passed = passed && (intptr_t) spsc_dequeue (q) == i;
+  pthread_join (producer, NULL);
+  passed = passed && spsc_try_dequeue (q) == QUEUE_EMPTY;
+  destroy_spsc_queue (q);
+  return passed;
+}
+
+void
+test_spinning_transfer ()
+{
+  print_result ("SPSC Spinning Transfer Test", transfer (0));
+}
+
+void
+test_parking_transfer ()
+{
+  print_result ("SPSC Parking Transfer Test", transfer (1));
+}
+
+void *
+slow_consumer (void *result)
+{
+  nanosleep (&(struct timespec) {.tv_nsec = 100000000}, NULL);
+  intptr_t sum = 0;
+  for (int i = 0; i < 4; ++i)
+    sum += (intptr_t) spsc_dequeue (q);
+  *(intptr_t *) result = sum;
+  return NULL;
+}
+
+void
+test_parked_producer ()
+{
+  // The producer fills the queue and parks until the consumer turns up.
+  q = make_spsc_queue (2, 1);
+  pthread_t consumer;
+  intptr_t sum = 0;
+  pthread_create (&consumer, NULL, slow_consumer, &sum);
+  for (intptr_t i = 1; i <= 4; ++i)
+    spsc_enqueue (q, (void *) i);
+  pthread_join (consumer, NULL);
+  print_result ("SPSC Parked Producer Test", sum == 10);
+  destroy_spsc_queue (q);
+}
+
+int
+main ()
+{
+  test_capacity ();
+  test_spinning_transfer ();
+  test_parking_transfer ();
+  test_parked_producer ();
+
+  printf ("Final Score: %d/4\n", score);
+  return 0;
+}
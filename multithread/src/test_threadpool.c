@@ -0,0 +1,126 @@
+/* test_threadpool.c */
+#define _POSIX_C_SOURCE 200809L	// nanosleep
+#include "threadpool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int score = 0;
+#define NUM_TASKS 1000
+
+void
+print_result (const char *test_name, int passed)
+{
+  if (passed)
+    {
+      printf ("[PASS] %s\n", test_name);
+      score += 1;
+    }
+  else
+    {
+      printf ("[FAIL] %s\n", test_name);
+    }
+}
+
+void *
+square (void *arg)
+{
+  intptr_t n = (intptr_t) arg;
+  return (void *) (n * n);
+}
+
+void *
+count_task (void *arg)
+{
+  __atomic_add_fetch ((long *) arg, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+void *
+slow_count_task (void *arg)
+{
+  nanosleep (&(struct timespec) {.tv_nsec = 1000000}, NULL);
+  return count_task (arg);
+}
+
+void
+test_default_size ()
+{
+  struct threadpool *pool = threadpool_create (0);
+  int passed = pool && threadpool_size (pool) >= 1;
+  threadpool_shutdown (pool);
+  pool = threadpool_create (3);
+  passed = passed && pool && threadpool_size (pool) == 3;
+  threadpool_shutdown (pool);
+  print_result ("Default Pool Size Test", passed);
+}
+
+void
+test_futures ()
+{
+  struct threadpool *pool = threadpool_create (4);
+  struct future *futures[NUM_TASKS];
+  for (intptr_t i = 0; i < NUM_TASKS; ++i)
+    futures[i] = threadpool_submit (pool, square, (void *) i);
+  int passed = 1;
+  for (intptr_t i = 0; i < NUM_TASKS; ++i)
+    {
+      passed = passed && (intptr_t) future_get (futures[i]) == i * i;
+      // A second get returns the same result without blocking.
+      passed = passed && (intptr_t) future_get (futures[i]) == i * i;
+      future_destroy (futures[i]);
+    }
+  threadpool_shutdown (pool);
+  print_result ("Future Result Test", passed);
+}
+
+void
+test_task_group ()
+{
+  struct threadpool *pool = threadpool_create (4);
+  struct task_group *group = task_group_create (pool);
+  long count = 0;
+  for (int i = 0; i < 100; ++i)
+    task_group_submit (group, slow_count_task, &count);
+  task_group_wait (group);
+  int passed = __atomic_load_n (&count, __ATOMIC_SEQ_CST) == 100;
+
+  // A group can be reused once it's been waited for.
+  for (int i = 0; i < 100; ++i)
+    task_group_submit (group, count_task, &count);
+  task_group_wait (group);
+  passed = passed && __atomic_load_n (&count, __ATOMIC_SEQ_CST) == 200;
+  // Waiting on an empty group returns at once.
+  task_group_wait (group);
+  task_group_destroy (group);
+  threadpool_shutdown (pool);
+  print_result ("Task Group Test", passed);
+}
+
+void
+test_graceful_shutdown ()
+{
+  // One worker and slow tasks, so most are still queued at shutdown.
+  struct threadpool *pool = threadpool_create (1);
+  struct task_group *group = task_group_create (pool);
+  long count = 0;
+  for (int i = 0; i < 50; ++i)
+    task_group_submit (group, slow_count_task, &count);
+  threadpool_shutdown (pool);
+  // Every queued task ran before the workers exited.
+  print_result ("Graceful Shutdown Test", count == 50);
+  task_group_destroy (group);
+}
+
+int
+main ()
+{
+  test_default_size ();
+  test_futures ();
+  test_task_group ();
+  test_graceful_shutdown ();
+
+  printf ("Final Score: %d/4\n", score);
+  return 0;
+}
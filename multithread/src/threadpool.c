@@ -0,0 +1,273 @@
+/* threadpool.c */
+#define _POSIX_C_SOURCE 200809L	// sysconf
+#include "threadpool.h"
+#include "queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct threadpool
+{
+  struct queue *tasks;
+  size_t n_threads;
+  pthread_t *threads;
+};
+
+// Completion is signalled the same way for futures and groups: a mutex and
+// a condition variable around a count of unfinished tasks (at most 1 for a
+// future).
+struct completion
+{
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  size_t pending;
+};
+
+struct future
+{
+  struct completion completion;
+  void *result;
+};
+
+struct task_group
+{
+  struct completion completion;
+  struct threadpool *pool;
+};
+
+// What goes through the queue. Exactly one of future and group is set.
+struct task
+{
+  task_fn fn;
+  void *arg;
+  struct future *future;
+  struct task_group *group;
+};
+
+static void
+completion_init (struct completion *c)
+{
+  pthread_mutex_init (&c->lock, NULL);
+  pthread_cond_init (&c->done, NULL);
+  c->pending = 0;
+}
+
+static void
+completion_add (struct completion *c)
+{
+  pthread_mutex_lock (&c->lock);
+  c->pending++;
+  pthread_mutex_unlock (&c->lock);
+}
+
+static void
+completion_finish (struct completion *c)
+{
+  pthread_mutex_lock (&c->lock);
+  if (--c->pending == 0)
+    pthread_cond_broadcast (&c->done);
+  pthread_mutex_unlock (&c->lock);
+}
+
+static void
+completion_wait (struct completion *c)
+{
+  pthread_mutex_lock (&c->lock);
+  while (c->pending)
+    pthread_cond_wait (&c->done, &c->lock);
+  pthread_mutex_unlock (&c->lock);
+}
+
+static void
+completion_destroy (struct completion *c)
+{
+  pthread_cond_destroy (&c->done);
+  pthread_mutex_destroy (&c->lock);
+}
+
+static void *
+worker_thread (void *arg)
+{
+  struct threadpool *pool = arg;
+  struct task *task;
+  // Run tasks until the pool is shut down and they've all been taken.
+  while ((task = dequeue (pool->tasks)) != QUEUE_CLOSED)
+    {
+      void *result = task->fn (task->arg);
+      if (task->future)
+	{
+	  // Write the result before the waiter can see the task is done.
+	  pthread_mutex_lock (&task->future->completion.lock);
+	  task->future->result = result;
+	  pthread_mutex_unlock (&task->future->completion.lock);
+	  completion_finish (&task->future->completion);
+	}
+      else
+	{
+	  completion_finish (&task->group->completion);
+	}
+      free (task);
+    }
+  return NULL;
+}
+
+struct threadpool *
+threadpool_create (size_t n_threads)
+{
+  if (n_threads == 0)
+    {
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      n_threads = cpus > 0 ? cpus : 1;
+    }
+
+  struct threadpool *pool = malloc (sizeof (struct threadpool));
+  if (!pool)
+    {
+      fprintf (stderr, "Failed to allocate thread pool.\n");
+      return NULL;
+    }
+  pool->tasks = make_queue ();
+  pool->threads = malloc (n_threads * sizeof (pthread_t));
+  if (!pool->tasks || !pool->threads)
+    {
+      fprintf (stderr, "Failed to allocate thread pool.\n");
+      destroy_queue (pool->tasks);
+      free (pool->threads);
+      free (pool);
+      return NULL;
+    }
+
+  for (pool->n_threads = 0; pool->n_threads < n_threads; pool->n_threads++)
+    {
+      if (pthread_create (&pool->threads[pool->n_threads], NULL,
+			  worker_thread, pool) != 0)
+	{
+	  fprintf (stderr, "Failed to start worker thread.\n");
+	  break;
+	}
+    }
+  if (pool->n_threads == 0)
+    {
+      threadpool_shutdown (pool);
+      return NULL;
+    }
+  return pool;
+}
+
+size_t
+threadpool_size (struct threadpool *pool)
+{
+  return pool->n_threads;
+}
+
+static int
+submit_task (struct threadpool *pool, task_fn fn, void *arg,
+	     struct future *future, struct task_group *group)
+{
+  struct task *task = malloc (sizeof (struct task));
+  if (!task)
+    {
+      fprintf (stderr, "Failed to allocate task.\n");
+      return 0;
+    }
+  task->fn = fn;
+  task->arg = arg;
+  task->future = future;
+  task->group = group;
+  enqueue (pool->tasks, task);
+  return 1;
+}
+
+struct future *
+threadpool_submit (struct threadpool *pool, task_fn fn, void *arg)
+{
+  struct future *f = malloc (sizeof (struct future));
+  if (!f)
+    {
+      fprintf (stderr, "Failed to allocate future.\n");
+      return NULL;
+    }
+  completion_init (&f->completion);
+  f->completion.pending = 1;
+  f->result = NULL;
+  if (!submit_task (pool, fn, arg, f, NULL))
+    {
+      completion_destroy (&f->completion);
+      free (f);
+      return NULL;
+    }
+  return f;
+}
+
+void
+threadpool_shutdown (struct threadpool *pool)
+{
+  if (!pool)
+    return;
+  // Workers drain what's left, then see QUEUE_CLOSED and exit.
+  queue_close (pool->tasks);
+  for (size_t i = 0; i < pool->n_threads; i++)
+    pthread_join (pool->threads[i], NULL);
+  destroy_queue (pool->tasks);
+  free (pool->threads);
+  free (pool);
+}
+
+void *
+future_get (struct future *f)
+{
+  completion_wait (&f->completion);
+  pthread_mutex_lock (&f->completion.lock);
+  void *result = f->result;
+  pthread_mutex_unlock (&f->completion.lock);
+  return result;
+}
+
+void
+future_destroy (struct future *f)
+{
+  if (!f)
+    return;
+  completion_wait (&f->completion);
+  completion_destroy (&f->completion);
+  free (f);
+}
+
+struct task_group *
+task_group_create (struct threadpool *pool)
+{
+  struct task_group *group = malloc (sizeof (struct task_group));
+  if (!group)
+    {
+      fprintf (stderr, "Failed to allocate task group.\n");
+      return NULL;
+    }
+  completion_init (&group->completion);
+  group->pool = pool;
+  return group;
+}
+
+void
+task_group_submit (struct task_group *group, task_fn fn, void *arg)
+{
+  completion_add (&group->completion);
+  if (!submit_task (group->pool, fn, arg, NULL, group))
+    completion_finish (&group->completion);
+}
+
+void
+task_group_wait (struct task_group *group)
+{
+  completion_wait (&group->completion);
+}
+
+void
+task_group_destroy (struct task_group *group)
+{
+  if (!group)
+    return;
+  completion_wait (&group->completion);
+  completion_destroy (&group->completion);
+  free (group);
+}
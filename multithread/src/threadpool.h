@@ -0,0 +1,45 @@
+/* threadpool.h */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+
+// A fixed set of worker threads that run submitted tasks, taking them from
+// a synchronized queue (queue.h) in the order they were submitted.
+
+struct threadpool;
+// The eventual result of a task submitted with threadpool_submit.
+struct future;
+// A set of tasks that can be waited for together.
+struct task_group;
+
+typedef void *(*task_fn) (void *arg);
+
+// Start a pool of n_threads workers, or one per online CPU if n_threads
+// is 0. Returns NULL on failure.
+struct threadpool *threadpool_create (size_t n_threads);
+// Number of worker threads in the pool.
+size_t threadpool_size (struct threadpool *pool);
+// Run fn(arg) on some worker. The future must be released with
+// future_destroy once its result is no longer needed.
+struct future *threadpool_submit (struct threadpool *pool, task_fn fn,
+				  void *arg);
+// Wait for shutdown: no more tasks may be submitted, tasks already
+// submitted are run, then the workers exit and the pool is freed.
+void threadpool_shutdown (struct threadpool *pool);
+
+// Block until the task is done, and return what fn returned.
+void *future_get (struct future *f);
+// Release a future. If the task hasn't finished yet, it's waited for.
+void future_destroy (struct future *f);
+
+// Create an empty group whose tasks run on pool.
+struct task_group *task_group_create (struct threadpool *pool);
+// Run fn(arg) on some worker, as part of group. Its result is discarded.
+void task_group_submit (struct task_group *group, task_fn fn, void *arg);
+// Block until every task submitted to group so far has finished.
+void task_group_wait (struct task_group *group);
+// Wait for the group, then free it.
+void task_group_destroy (struct task_group *group);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,417 @@
+// Scheduler benchmark.
+//
+// Generates synthetic workloads, runs mysh over each of them with every
+// scheduling policy, and reports how the policies compare. Usage:
+//   ./bench [RESULTS_DIR]
+// Results go to bench.csv and bench.json in RESULTS_DIR (created if need
+// be), or in a new directory under /tmp if none is given, and the CSV is
+// also printed to stdout. Run it from the source directory: it copies the
+// sources into a scratch directory and builds its own mysh there, so the
+// build in the source directory is left alone.
+//
+// Every line of a generated program is `echo P<i>`, so each line of mysh's
+// output identifies the process that ran an instruction. Time is measured
+// on that "instruction clock": the nth instruction line printed happens at
+// time n. Per program, we derive
+//   turnaround = completion - arrival
+//   wait       = turnaround - instructions run
+// and per run, the number of context switches (consecutive instruction
+// lines from different programs), page faults ("Page fault!" lines) and
+// throughput (instructions per second of wall clock time, best of
+// BENCH_RUNS).
+//
+// A workload is a top-level exec of three programs. Background workloads
+// exec with #, and the rest of their input execs more batches of three
+// while the schedule is running. Before each of those execs it prints a
+// marker, `@<batch>`, which gives the arrival time of that batch.
+// Duplicate programs (exec'd more than once) share one name, so their
+// statistics are for all their copies together. Lines a process failed to
+// run (mysh reports an error instead) don't count as instructions.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>		// mkdir
+#include <time.h>
+#include <unistd.h>
+
+// Frame store lines. Programs are much longer than this, so they page.
+#define FRAMESIZE 300
+#define BENCH_RUNS 3
+#define BATCH_SIZE 3
+#define MAX_BATCHES 8
+#define MAX_PROGRAMS (BATCH_SIZE * MAX_BATCHES)
+#define MAX_LINE 256
+
+// Every policy get_policy knows about. Keep this in sync with it.
+static const char *policies[] = {
+  "FCFS", "SJF", "RR", "RR30", "RR:4", "RR:auto", "RR:1ms", "AGING",
+  "MLFQ", "STRIDE", "LOTTERY", "CFS", "SRTF", "EDF"
+};
+
+enum length_distribution
+{
+  UNIFORM,			// every program the same length
+  SKEWED,			// mostly short, with a long tail
+  BIMODAL			// either very short or long
+};
+
+struct workload
+{
+  const char *name;
+  enum length_distribution lengths;
+  int batches;			// 1 means no background execs
+  int duplicates;		// reuse an earlier program every this many (0: never)
+};
+
+static const struct workload workloads[] = {
+  {"uniform", UNIFORM, 1, 0},
+  {"skewed", SKEWED, 1, 0},
+  {"bimodal", BIMODAL, 1, 0},
+  {"duplicates", UNIFORM, 1, 2},
+  {"background", SKEWED, MAX_BATCHES, 0},
+  {"background-dups", BIMODAL, MAX_BATCHES, 3}
+};
+
+// A small deterministic generator, so every policy sees the same workload.
+static unsigned long seed;
+
+static unsigned
+next_random (unsigned bound)
+{
+  seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+  return (seed >> 33) % bound;
+}
+
+static int
+program_length (enum length_distribution lengths)
+{
+  switch (lengths)
+    {
+    case UNIFORM:
+      return 2000;
+    case SKEWED:
+      // 250..7999, each doubling about half as likely as the last.
+      {
+	int length = 250;
+	while (length < 4000 && next_random (2))
+	  length *= 2;
+	return length + next_random (length);
+      }
+    case BIMODAL:
+      return next_random (4) ? 100 : 5000;
+    }
+  return 0;
+}
+
+struct program_stats
+{
+  long arrival;
+  long completion;
+  long instructions;
+};
+
+struct result
+{
+  int programs;
+  long instructions;
+  long context_switches;
+  long page_faults;
+  double best_seconds;
+  double turnaround_mean, turnaround_p99;
+  double wait_mean, wait_p99;
+};
+
+// Scratch space: the mysh build, the generated programs and the output.
+static char dir[] = "/tmp/mysh-bench-XXXXXX";
+
+// Write the programs for w, and the input that runs them under policy,
+// to dir. Returns the path of the input file, in a static buffer.
+static const char *
+generate (const struct workload *w, const char *policy)
+{
+  static char input_path[MAX_LINE];
+  char path[MAX_LINE];
+  int lengths[MAX_PROGRAMS];
+
+  seed = 42;
+  for (int p = 0; p < w->batches * BATCH_SIZE; p++)
+    {
+      lengths[p] = program_length (w->lengths);
+      snprintf (path, sizeof (path), "%s/P%d", dir, p);
+      FILE *f = fopen (path, "w");
+      for (int line = 0; line < lengths[p]; line++)
+	fprintf (f, "echo P%d\n", p);
+      fclose (f);
+    }
+
+  snprintf (input_path, sizeof (input_path), "%s/input", dir);
+  FILE *input = fopen (input_path, "w");
+  for (int batch = 0; batch < w->batches; batch++)
+    {
+      if (batch > 0)
+	fprintf (input, "echo @%d\n", batch);
+      fprintf (input, "exec");
+      for (int i = 0; i < BATCH_SIZE; i++)
+	{
+	  int p = batch * BATCH_SIZE + i;
+	  if (w->duplicates && p > 0 && p % w->duplicates == 0)
+	    p--;
+	  fprintf (input, " %s/P%d", dir, p);
+	}
+      fprintf (input, " %s%s\n", policy,
+	       batch == 0 && w->batches > 1 ? " #" : "");
+    }
+  // A background script shouldn't quit: that would end the schedule
+  // before the programs it exec'd have run. mysh quits by itself once
+  // they're done.
+  if (w->batches == 1)
+    fprintf (input, "quit\n");
+  fclose (input);
+  return input_path;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of the n values in v, which it sorts.
+static double
+percentile (double *v, int n, double p)
+{
+  qsort (v, n, sizeof (double), compare_double);
+  int rank = (int) (p / 100 * n + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  return v[rank - 1];
+}
+
+// Read mysh's output and fill in everything in r but best_seconds.
+static void
+analyze (const char *output_path, struct result *r)
+{
+  struct program_stats stats[MAX_PROGRAMS + 1] = { 0 };
+  long batch_arrival[MAX_BATCHES] = { 0 };
+  // stats[MAX_PROGRAMS] is the background stdin script itself.
+  const int stdin_script = MAX_PROGRAMS;
+  int last = -1;
+  long clock = 0;
+  char line[MAX_LINE];
+
+  memset (r, 0, sizeof (*r));
+  FILE *out = fopen (output_path, "r");
+  while (fgets (line, sizeof (line), out))
+    {
+      int p, batch;
+      if (strncmp (line, "Page fault!", 11) == 0)
+	{
+	  r->page_faults++;
+	  continue;
+	}
+      if (sscanf (line, "P%d", &p) == 1 && p >= 0 && p < MAX_PROGRAMS)
+	;
+      else if (sscanf (line, "@%d", &batch) == 1 && batch > 0
+	       && batch < MAX_BATCHES)
+	{
+	  p = stdin_script;
+	  batch_arrival[batch] = clock;
+	}
+      else
+	continue;
+
+      clock++;
+      if (!stats[p].instructions && p != stdin_script)
+	stats[p].arrival = batch_arrival[p / BATCH_SIZE];
+      stats[p].instructions++;
+      stats[p].completion = clock;
+      if (last != -1 && last != p)
+	r->context_switches++;
+      last = p;
+    }
+  fclose (out);
+
+  double turnaround[MAX_PROGRAMS + 1], wait[MAX_PROGRAMS + 1];
+  for (int p = 0; p <= MAX_PROGRAMS; p++)
+    {
+      if (!stats[p].instructions)
+	continue;
+      turnaround[r->programs] = stats[p].completion - stats[p].arrival;
+      wait[r->programs] = turnaround[r->programs] - stats[p].instructions;
+      r->turnaround_mean += turnaround[r->programs];
+      r->wait_mean += wait[r->programs];
+      r->instructions += stats[p].instructions;
+      r->programs++;
+    }
+  if (!r->programs)
+    return;
+  r->turnaround_mean /= r->programs;
+  r->wait_mean /= r->programs;
+  r->turnaround_p99 = percentile (turnaround, r->programs, 99);
+  r->wait_p99 = percentile (wait, r->programs, 99);
+}
+
+// Remove the scratch directory. Registered with atexit once it exists, so
+// that no way out of main leaves it behind.
+static void
+remove_scratch (void)
+{
+  char command[MAX_LINE];
+  snprintf (command, sizeof (command), "rm -r %s", dir);
+  system (command);
+}
+
+// Create path and any missing parents, like `mkdir -p`. Returns 0 on
+// success.
+static int
+make_directories (const char *path)
+{
+  char partial[MAX_LINE];
+  snprintf (partial, sizeof (partial), "%s", path);
+  for (char *p = partial + 1; *p; p++)
+    {
+      if (*p != '/')
+	continue;
+      *p = '\0';
+      if (mkdir (partial, 0777) != 0 && errno != EEXIST)
+	return -1;
+      *p = '/';
+    }
+  if (mkdir (partial, 0777) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+// Open name in the results directory for writing, reporting any failure.
+static FILE *
+open_result (const char *results, const char *name)
+{
+  char path[MAX_LINE];
+  snprintf (path, sizeof (path), "%s/%s", results, name);
+  FILE *f = fopen (path, "w");
+  if (!f)
+    perror (path);
+  return f;
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int n_policies = sizeof (policies) / sizeof (policies[0]);
+  int n_workloads = sizeof (workloads) / sizeof (workloads[0]);
+  char command[2 * MAX_LINE], output_path[MAX_LINE];
+  static char results_dir[] = "/tmp/mysh-bench-results-XXXXXX";
+  const char *results = argc > 1 ? argv[1] : results_dir;
+
+  if (argc > 2)
+    {
+      fprintf (stderr, "Usage: %s [RESULTS_DIR]\n", argv[0]);
+      return 1;
+    }
+  if (!mkdtemp (dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+  atexit (remove_scratch);
+  if (argc == 1 && !mkdtemp (results_dir))
+    {
+      perror ("mkdtemp");
+      return 1;
+    }
+  if (make_directories (results) != 0)
+    {
+      perror (results);
+      return 1;
+    }
+  snprintf (output_path, sizeof (output_path), "%s/output", dir);
+
+  // init_linemem clears FRAME_STORE_SIZE entries of a VAR_MEM_SIZE array,
+  // so the variable store must be at least as big as the frame store.
+  snprintf (command, sizeof (command),
+	    "mkdir %s/build && cp *.c *.h Makefile %s/build && "
+	    "make -s -C %s/build mysh framesize=%d varmemsize=%d > /dev/null",
+	    dir, dir, dir, FRAMESIZE, FRAMESIZE);
+  if (system (command) != 0)
+    {
+      fprintf (stderr, "Couldn't build mysh\n");
+      return 1;
+    }
+
+  FILE *csv = open_result (results, "bench.csv");
+  if (!csv)
+    return 1;
+  FILE *json = open_result (results, "bench.json");
+  if (!json)
+    return 1;
+  const char *header =
+    "policy,workload,programs,instructions,throughput_ips,"
+    "turnaround_mean,turnaround_p99,wait_mean,wait_p99,"
+    "context_switches,page_faults\n";
+  fputs (header, csv);
+  fputs (header, stdout);
+  fprintf (json, "[\n");
+
+  for (int w = 0; w < n_workloads; w++)
+    {
+      for (int p = 0; p < n_policies; p++)
+	{
+	  const char *input = generate (&workloads[w], policies[p]);
+	  snprintf (command, sizeof (command), "%s/build/mysh < %s > %s 2>&1",
+		    dir, input, output_path);
+	  struct result r;
+	  double best = 0;
+	  for (int run = 0; run < BENCH_RUNS; run++)
+	    {
+	      double start = now ();
+	      system (command);
+	      double elapsed = now () - start;
+	      if (run == 0 || elapsed < best)
+		best = elapsed;
+	    }
+	  analyze (output_path, &r);
+	  r.best_seconds = best;
+
+	  char row[MAX_LINE];
+	  snprintf (row, sizeof (row),
+		    "%s,%s,%d,%ld,%.0f,%.2f,%.0f,%.2f,%.0f,%ld,%ld\n",
+		    policies[p], workloads[w].name, r.programs,
+		    r.instructions, r.instructions / r.best_seconds,
+		    r.turnaround_mean, r.turnaround_p99, r.wait_mean,
+		    r.wait_p99, r.context_switches, r.page_faults);
+	  fputs (row, csv);
+	  fputs (row, stdout);
+	  fprintf (json,
+		   "  {\"policy\": \"%s\", \"workload\": \"%s\", "
+		   "\"programs\": %d, \"instructions\": %ld, "
+		   "\"throughput_ips\": %.0f, \"turnaround_mean\": %.2f, "
+		   "\"turnaround_p99\": %.0f, \"wait_mean\": %.2f, "
+		   "\"wait_p99\": %.0f, \"context_switches\": %ld, "
+		   "\"page_faults\": %ld}%s\n",
+		   policies[p], workloads[w].name, r.programs,
+		   r.instructions, r.instructions / r.best_seconds,
+		   r.turnaround_mean, r.turnaround_p99, r.wait_mean,
+		   r.wait_p99, r.context_switches, r.page_faults,
+		   w == n_workloads - 1 && p == n_policies - 1 ? "" : ",");
+	}
+    }
+
+  fprintf (json, "]\n");
+  fclose (json);
+  fclose (csv);
+
+  fprintf (stderr, "Results are in %s/bench.csv and %s/bench.json\n",
+	   results, results);
+  return 0;
+}
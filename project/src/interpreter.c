@@ -1,3 +1,4 @@
+#define _GNU_SOURCE		// gettid, SIGEV_THREAD_ID
 #ifdef NDEBUG
 #define debug(...)
 #else
@@ -5,9 +6,16 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>		// timer_create
+#ifndef sigev_notify_thread_id	// Not exposed by glibc before 2.41.
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 #include <ctype.h>		// tolower, isdigit
 #include <dirent.h>		// scandir
 #include <unistd.h>		// chdir
@@ -21,6 +29,8 @@
 #include "schedule_policy.h"
 #include "shellmemory.h"
 #include "shell.h"
+#include "trace.h"
+#include "workers.h"
 
 #define true 1
 #define false 0
@@ -193,6 +203,14 @@ interpreter (char *command_args[], int args_size)
 	return badcommand ();
       return my_exec (&command_args[1], args_size - 1);
 
+    }
+  else if (strcmp (command_args[0], "ps") == 0)
+    {
+      if (args_size != 1)
+	return badcommand ();
+      print_processes (stdout);
+      return 0;
+
     }
   else if (strcmp (command_args[0], "run") == 0)
     {
@@ -215,7 +233,8 @@ help			Displays all the commands\n \
 quit			Exits / terminates the shell with “Bye!”\n \
 set VAR STRING		Assigns a value to shell memory\n \
 print VAR		Displays the STRING assigned to VAR\n \
-source SCRIPT.TXT		Executes the file SCRIPT.TXT\n ";
+source SCRIPT.TXT		Executes the file SCRIPT.TXT\n \
+ps			Lists running processes and their accounting\n ";
   printf ("%s\n", help_string);
   return 0;
 }
@@ -497,37 +516,151 @@ runSchedule (struct queue *q, const struct schedule_policy *policy)
     }
 }
 
+// Each worker thread (or just the main thread, if not in MT mode) runs at
+// most one process at a time, so these are per-thread.
+static __thread struct PCB *running_pcb = NULL;
+// Also set from the time slice timer's signal handler.
+static __thread volatile sig_atomic_t preempt_requested = false;
+// Instructions executed by all processes, on all threads.
+static atomic_size_t instructions_retired = 0;
+
+size_t
+instruction_clock ()
+{
+  return atomic_load_explicit (&instructions_retired, memory_order_relaxed);
+}
+
+struct PCB *
+current_process ()
+{
+  return running_pcb;
+}
+
+void
+request_preemption ()
+{
+  preempt_requested = true;
+}
+
+// Copy the next instruction of pcb into line, which must have room for
+// MAX_USER_INPUT characters. Returns 0 if a page fault occurred instead,
+// or if the instruction is missing and the process had to be ended.
+// We copy rather than handing out the frame store's own string: once the
+// lock is released, a worker running another process may evict the frame.
+static int
+fetch_instruction (struct PCB *pcb, char *line)
+{
+  lock_frame_store ();
+  size_t instr = pcb_next_instruction (pcb);
+  if (instr == (size_t) -1)
+    {
+      unlock_frame_store ();
+      return 0;
+    }
+  const char *src = get_line (instr);
+  if (!src)
+    {
+      // The page table points at a frame that doesn't hold our code, so
+      // there's nothing sensible left to run.
+      fprintf (stderr, "Ending process %zu: instruction %zu is missing\n",
+	       pcb->pid, pcb->pc - 1);
+      pcb_end (pcb);
+      unlock_frame_store ();
+      return 0;
+    }
+  strncpy (line, src, MAX_USER_INPUT - 1);
+  line[MAX_USER_INPUT - 1] = '\0';
+  unlock_frame_store ();
+  return 1;
+}
+
+// Accounting for the start and end of a time slice; see struct PCB.
+// pcb is the running process in between. end_slice retires the process
+// if it has finished.
+static size_t
+begin_slice (struct PCB *pcb)
+{
+  size_t now = pcb_now_ns ();
+  running_pcb = pcb;
+  trace_event (TRACE_DISPATCH, pcb->pid, -1, NULL);
+  pcb_stat_add (&pcb->dispatches, 1);
+  pcb_stat_add (&pcb->wait_ns, now - pcb->ready_since_ns);
+  pcb_stat_set (&pcb->ready_since_ns, 0);
+  return now;
+}
+
+static void
+end_slice (struct PCB *pcb, size_t start)
+{
+  size_t now = pcb_now_ns ();
+  running_pcb = NULL;
+  pcb_stat_add (&pcb->cpu_ns, now - start);
+  trace_event (TRACE_SLICE_END, pcb->pid, -1, NULL);
+  if (pcb_has_next_instruction (pcb))
+    pcb_stat_set (&pcb->ready_since_ns, now);
+  else
+    retire_pcb (pcb);
+}
+
+// Run the next instruction of pcb, and count it. Returns 0 if it couldn't
+// be fetched; see fetch_instruction.
+static int
+run_instruction (struct PCB *pcb)
+{
+  char line[MAX_USER_INPUT];
+  if (!fetch_instruction (pcb, line))
+    return 0;
+  parseInput (line);
+  pcb_stat_add (&pcb->instructions, 1);
+  atomic_fetch_add_explicit (&instructions_retired, 1, memory_order_relaxed);
+  return 1;
+}
+
 struct PCB *
 run_pcb_to_completion (struct PCB *pcb)
 {
+  size_t start = begin_slice (pcb);
   while (pcb_has_next_instruction (pcb))
     {
-      size_t instr = pcb_next_instruction (pcb);
-      if (instr == (size_t) -1)
+      if (!run_instruction (pcb))
 	{
-	  // Page fault occurred, process needs to be rescheduled
-	  return pcb;
+	  // Page fault occurred, process needs to be rescheduled, unless
+	  // the page couldn't be loaded and the process was ended.
+	  end_slice (pcb, start);
+	  if (pcb_has_next_instruction (pcb))
+	    return pcb;
+	  free_pcb (pcb);
+	  return NULL;
 	}
-      parseInput (get_line (instr));
     }
+  end_slice (pcb, start);
   free_pcb (pcb);
   return NULL;
 }
 
-struct PCB *
-run_pcb_for_n_steps (struct PCB *pcb, size_t n)
+// The body of run_pcb_for_n_steps, without clearing preempt_requested
+// first, so that a time slice timer can be armed before we start.
+static struct PCB *
+run_steps (struct PCB *pcb, size_t n)
 {
   debug ("run n steps: n is %ld\n", n);
+  size_t start = begin_slice (pcb);
   for (; n && pcb_has_next_instruction (pcb); --n)
     {
-      size_t instr = pcb_next_instruction (pcb);
-      if (instr == (size_t) -1)
+      if (!run_instruction (pcb))
+	{
+	  // Page fault occurred, process needs to be rescheduled. If the
+	  // page couldn't be loaded, the process was ended instead, which
+	  // the check below takes care of.
+	  break;
+	}
+      if (preempt_requested)
 	{
-	  // Page fault occurred, process needs to be rescheduled
-	  return pcb;
+	  trace_event (TRACE_PREEMPT, pcb->pid, -1, NULL);
+	  break;
 	}
-      parseInput (get_line (instr));
     }
+  end_slice (pcb, start);
   debug ("run n steps: looped to %ld\n", n);
   // The loop runs until either we've done n steps or the pcb is out of
   // instructions,  whichever happens first. But they might also happen
@@ -548,6 +681,65 @@ run_pcb_for_n_steps (struct PCB *pcb, size_t n)
 
 }
 
+struct PCB *
+run_pcb_for_n_steps (struct PCB *pcb, size_t n)
+{
+  preempt_requested = false;
+  return run_steps (pcb, n);
+}
+
+static void
+time_slice_expired (int sig)
+{
+  (void) sig;
+  preempt_requested = true;
+}
+
+static void
+install_time_slice_handler ()
+{
+  // SA_RESTART keeps the signal from interrupting whatever system call the
+  // current instruction is in, e.g. waitpid in `run`; we only look at the
+  // flag between instructions anyway.
+  struct sigaction sa = {.sa_handler = time_slice_expired,
+    .sa_flags = SA_RESTART
+  };
+  sigemptyset (&sa.sa_mask);
+  sigaction (SIGALRM, &sa, NULL);
+}
+
+struct PCB *
+run_pcb_for_time_slice (struct PCB *pcb, long usec)
+{
+  static pthread_once_t handler_installed = PTHREAD_ONCE_INIT;
+  pthread_once (&handler_installed, install_time_slice_handler);
+
+  // The timer's signal is directed at this thread, so in MT mode each
+  // worker's slices are timed independently.
+
+  struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID,
+    .sigev_signo = SIGALRM
+  };
+  sev.sigev_notify_thread_id = gettid ();
+  timer_t timer;
+  if (timer_create (CLOCK_MONOTONIC, &sev, &timer) != 0)
+    {
+      perror ("timer_create");
+      return run_pcb_for_n_steps (pcb, (size_t) -1);
+    }
+  struct itimerspec slice = {.it_value = {.tv_sec = usec / 1000000,
+					  .tv_nsec = usec % 1000000 * 1000}
+  };
+
+  preempt_requested = false;
+  timer_settime (timer, 0, &slice, NULL);
+  pcb = run_steps (pcb, (size_t) -1);
+  // Deleting the timer also disarms it, if it hasn't fired yet.
+  timer_delete (timer);
+  preempt_requested = false;
+  return pcb;
+}
+
 int
 source (char *script)
 {
@@ -568,6 +760,39 @@ source (char *script)
 static int background = false;
 static struct queue *q = NULL;
 static const struct schedule_policy *policy = NULL;
+// Number of worker threads for MT mode. 0 means the usual single-threaded
+// runSchedule.
+static size_t workers = 0;
+
+// Program arguments to exec may carry numeric parameters, in either order:
+//   prog:N   N tickets, for the proportional-share policies
+//   prog@N   a deadline N instructions from now, for EDF
+// as in `exec prog1:300 prog2@50 prog3:100@80 EDF`. Cut them off arg
+// (in place) and store them, leaving defaults for any that are absent.
+// A ':' or '@' that isn't followed by only digits is left alone as part
+// of the filename.
+static void
+split_program_arg (char *arg, size_t *tickets, size_t *deadline)
+{
+  *tickets = DEFAULT_TICKETS;
+  *deadline = NO_DEADLINE;
+  while (1)
+    {
+      char *sep = arg + strlen (arg);
+      while (sep > arg && isdigit (sep[-1]))
+	--sep;
+      if (sep == arg + strlen (arg) || sep - 1 <= arg
+	  || (sep[-1] != ':' && sep[-1] != '@'))
+	return;
+
+      size_t value = strtoul (sep, NULL, 10);
+      if (sep[-1] == ':')
+	*tickets = value;
+      else
+	*deadline = instruction_clock () + value;
+      sep[-1] = '\0';
+    }
+}
 
 int
 my_exec (char *args[], int args_size)
@@ -599,8 +824,28 @@ my_exec (char *args[], int args_size)
 
 
   // We check from the end, so we have to check in reverse order.
+  // MT (or MT:<n>) comes last, and asks for the schedule to be run by
+  // worker threads; see workers.h. It only means something on a top-level
+  // exec. A background exec joins whatever schedule is already running.
+  size_t mt_workers = 0;
+  if (strncmp (args[args_size - 1], "MT", 2) == 0)
+    {
+      char *count = args[args_size - 1] + 2;
+      if (*count == '\0')
+	{
+	  mt_workers = default_worker_count ();
+	}
+      else if (*count == ':' && isdigit (count[1]))
+	{
+	  mt_workers = strtoul (count + 1, NULL, 10);
+	}
+      if (mt_workers > 0)
+	{
+	  args_size--;		// effectively remove "MT" from the arguments.
+	}
+    }
   // Now look for #.
-  if (strcmp (args[args_size - 1], "#") == 0)
+  if (args_size > 0 && strcmp (args[args_size - 1], "#") == 0)
     {
       background = true;
       args_size--;		// effectively remove "#" from the arguments.
@@ -621,12 +866,19 @@ my_exec (char *args[], int args_size)
   args_size--;
   // Now the args,args_size array describes exactly the filenames.
   // We know the policy name now, so retrieve the actual policy.
-  policy = get_policy (policy_name);
-  if (!policy)
+  const struct schedule_policy *requested =
+    get_policy (policy_name, !background_exec);
+  if (!requested)
     {
       printf ("Bad command: unknown scheduling policy\n");
       return 1;
     }
+  // A background exec joins the schedule that's already running, so its
+  // programs are queued the way that schedule's policy expects, whatever
+  // this exec asked for. Otherwise e.g. STRIDE would put them on the heap,
+  // which RR's dequeue never looks at.
+  if (!background_exec)
+    policy = requested;
 
 
   if (!background_exec)
@@ -639,6 +891,7 @@ my_exec (char *args[], int args_size)
       // We own this, so we have to be sure to free it later!
       assert (!q);
       q = alloc_queue ();
+      workers = mt_workers;
     }
   else
     {
@@ -650,28 +903,28 @@ my_exec (char *args[], int args_size)
   // Create a filename for each process, in order, and enqueue them.
   // We are allocating PCBs, but enqueue transfers ownership of the PCB
   // to the queue, so we're not responsible for freeing these.
+  // In MT mode, workers may be using the queue while we do this.
+  lock_schedule ();
   for (int n = 0; n < args_size; ++n)
     {
-
-      // Two scripts have the same filename ==> error
-      // ---------------------------------------------
-      // We check if two scripts have the same filename by scanning the
-      // existing queue. We do this because we know assignment 3 is about
-      // memory management and it's likely we're being told to error in
-      // assignment 2 so that in assignment 3 we can implement memory
-      // sharing. Since it's not tested, it doesn't really matter what we do.
-      // We're going to assume that for this check, 'recursive exec'
-      // is not involved. This guarantees that all
-      // scheduled processes are visible on the queue while we check
-      // file names. That assumption will hold for assignment 3.
-      // Obviously it doesn't hold in a real OS!
-      // Having a proper process table, rather than only a schedule,
-      // would solve that problem.
-
-      if (program_already_scheduled (q, args[n]))
+      // Strip off tickets and deadlines here, so everything below sees
+      // only the filename.
+      size_t tickets, deadline;
+      split_program_arg (args[n], &tickets, &deadline);
+
+      // Two scripts have the same filename ==> share the code
+      // ------------------------------------------------------
+      // If the program is already loaded by an unfinished process, the
+      // new one is a clone that shares its pages. We look in the process
+      // table rather than the queue: in MT mode, the original may be on
+      // a worker's local queue or running, not on q.
+
+      struct PCB *clone = clone_process_named (args[n]);
+      if (clone)
 	{
-	  struct PCB *pcb = pass_clone (q, args[n]);
-	  policy->enqueue (q, pcb);
+	  clone->tickets = tickets;
+	  clone->deadline = deadline;
+	  policy->enqueue (q, clone);
 
 	  continue;
 	}
@@ -683,14 +936,18 @@ my_exec (char *args[], int args_size)
       if (!pcb)
 	{
 	  printf ("Failed to create process\n");
+	  unlock_schedule ();
 	  goto cleanup;
 	}
 
+      pcb->tickets = tickets;
+      pcb->deadline = deadline;
       policy->enqueue (q, pcb);
 
 
 
     }
+  unlock_schedule ();
 
 
 
@@ -717,7 +974,15 @@ my_exec (char *args[], int args_size)
       // We should only start the scheduler if we are a top-level exec call.
       // If we are not top-level, it's already running!
 
-      runSchedule (q, policy);
+      if (workers)
+	runScheduleParallel (q, policy, workers);
+      else
+	runSchedule (q, policy);
+
+      if (policy->report)
+	policy->report ();
+      // On stderr, so it doesn't get in the way of the scripts' output.
+      print_process_summary (stderr);
 
       // After the schedule completes, if we were given the # argument,
       // the exec should never 'return'. When it's done, so is the batch
@@ -735,6 +1000,7 @@ my_exec (char *args[], int args_size)
       free_queue (q);
       q = NULL;
       policy = NULL;
+      workers = 0;
     }
 
 
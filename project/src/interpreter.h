@@ -9,4 +9,20 @@ struct PCB *run_pcb_to_completion (struct PCB *pcb);
 // If it has remaining instructions, return it.
 // Otherwise, clean it up and return NULL.
 // Partial applications of n make this suitable for schedule_policy::run_pcb.
+// Stops early if the process page faults or is preempted (see below).
 struct PCB *run_pcb_for_n_steps (struct PCB *pcb, size_t n);
+// Like run_pcb_for_n_steps, but the quantum is usec microseconds of wall
+// clock time rather than a number of instructions. A timer preempts the
+// process between instructions once it expires, however long they take.
+struct PCB *run_pcb_for_time_slice (struct PCB *pcb, long usec);
+
+// Total instructions executed so far by run_pcb_for_n_steps, across all
+// processes. This is the clock that EDF deadlines are measured against.
+size_t instruction_clock (void);
+
+// The PCB that the calling thread is currently running, or NULL if it isn't
+// running one. When a script execs more programs, this is the script.
+struct PCB *current_process (void);
+// Ask run_pcb_for_n_steps to stop the calling thread's current process
+// once its current instruction is finished, as if its quantum had run out.
+void request_preemption (void);
@@ -1,13 +1,163 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>		// memset
+#include <time.h>		// clock_gettime
 #include <limits.h>		// INT_MAX
 #include "shell.h"		// MAX_USER_INPUT
 #include "shellmemory.h"
 #include "pcb.h"
+#include "trace.h"
 
 static pid fresh_pid = 1;
 
+// Every PCB that hasn't been retired, linked through table_next, and the
+// accounting of the ones that have, until they're summarized.
+struct retired_process
+{
+  pid pid;
+  char *name;
+  size_t turnaround_ns, cpu_ns, wait_ns;
+  size_t instructions, faults, dispatches;
+  struct retired_process *next;
+};
+static struct PCB *process_table = NULL, **process_table_tail = &process_table;
+static struct retired_process *retired = NULL, **retired_tail = &retired;
+static pthread_mutex_t process_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t
+pcb_now_ns ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (size_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+init_accounting (struct PCB *pcb)
+{
+  pcb->arrival_ns = pcb->ready_since_ns = pcb_now_ns ();
+  pcb->cpu_ns = pcb->wait_ns = 0;
+  pcb->instructions = pcb->faults = pcb->dispatches = 0;
+
+  // Append, so that ps lists processes in the order they were created.
+  pthread_mutex_lock (&process_table_lock);
+  pcb->table_next = NULL;
+  *process_table_tail = pcb;
+  process_table_tail = &pcb->table_next;
+  pthread_mutex_unlock (&process_table_lock);
+}
+
+// Returns non-zero if pcb was in the table. Caller holds the lock.
+static int
+unlink_process (struct PCB *pcb)
+{
+  for (struct PCB ** link = &process_table; *link;
+       link = &(*link)->table_next)
+    {
+      if (*link == pcb)
+	{
+	  *link = pcb->table_next;
+	  if (process_table_tail == &pcb->table_next)
+	    process_table_tail = link;
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+static const char *
+display_name (const char *name)
+{
+  return *name ? name : "(shell input)";
+}
+
+void
+retire_pcb (struct PCB *pcb)
+{
+  pthread_mutex_lock (&process_table_lock);
+  if (unlink_process (pcb))
+    {
+      struct retired_process *r = malloc (sizeof (struct retired_process));
+      r->pid = pcb->pid;
+      r->name = strdup (display_name (pcb->name));
+      r->turnaround_ns = pcb_now_ns () - pcb->arrival_ns;
+      r->cpu_ns = pcb->cpu_ns;
+      r->wait_ns = pcb->wait_ns;
+      r->instructions = pcb->instructions;
+      r->faults = pcb->faults;
+      r->dispatches = pcb->dispatches;
+      r->next = NULL;
+      *retired_tail = r;
+      retired_tail = &r->next;
+    }
+  pthread_mutex_unlock (&process_table_lock);
+}
+
+void
+print_processes (FILE * out)
+{
+  // Workers may be updating the counters while we print them (see
+  // pcb_stat_add), so in MT mode this is only a snapshot.
+  pthread_mutex_lock (&process_table_lock);
+  size_t now = pcb_now_ns ();
+  fprintf (out, "%5s %-24s %5s %5s %6s %10s %10s %10s\n", "PID", "NAME",
+	   "PC", "LINES", "FAULTS", "SCHEDULED", "CPU_US", "WAIT_US");
+  for (struct PCB * pcb = process_table; pcb; pcb = pcb->table_next)
+    {
+      // A process that's waiting to be dispatched has been waiting since
+      // ready_since_ns, though we haven't added that to wait_ns yet.
+      size_t ready_since = __atomic_load_n (&pcb->ready_since_ns,
+					    __ATOMIC_RELAXED);
+      size_t waiting = ready_since ? now - ready_since : 0;
+      fprintf (out, "%5zu %-24s %5zu %5zu %6zu %10zu %10zu %10zu\n",
+	       pcb->pid, display_name (pcb->name),
+	       __atomic_load_n (&pcb->pc, __ATOMIC_RELAXED), pcb->line_count,
+	       __atomic_load_n (&pcb->faults, __ATOMIC_RELAXED),
+	       __atomic_load_n (&pcb->dispatches, __ATOMIC_RELAXED),
+	       __atomic_load_n (&pcb->cpu_ns, __ATOMIC_RELAXED) / 1000,
+	       (__atomic_load_n (&pcb->wait_ns, __ATOMIC_RELAXED) +
+		waiting) / 1000);
+    }
+  pthread_mutex_unlock (&process_table_lock);
+}
+
+void
+print_process_summary (FILE * out)
+{
+  pthread_mutex_lock (&process_table_lock);
+  if (!retired)
+    {
+      pthread_mutex_unlock (&process_table_lock);
+      return;
+    }
+  fprintf (out, "%5s %-24s %6s %6s %10s %10s %10s %13s\n", "PID", "NAME",
+	   "INSNS", "FAULTS", "SCHEDULED", "CPU_US", "WAIT_US",
+	   "TURNAROUND_US");
+  size_t n = 0, cpu_ns = 0, wait_ns = 0, faults = 0, dispatches = 0;
+  while (retired)
+    {
+      struct retired_process *r = retired;
+      fprintf (out, "%5zu %-24s %6zu %6zu %10zu %10zu %10zu %13zu\n",
+	       r->pid, r->name, r->instructions, r->faults, r->dispatches,
+	       r->cpu_ns / 1000, r->wait_ns / 1000, r->turnaround_ns / 1000);
+      n++;
+      cpu_ns += r->cpu_ns;
+      wait_ns += r->wait_ns;
+      faults += r->faults;
+      dispatches += r->dispatches;
+      retired = r->next;
+      free (r->name);
+      free (r);
+    }
+  retired_tail = &retired;
+  pthread_mutex_unlock (&process_table_lock);
+  fprintf (out,
+	   "%zu processes: %zu faults, %zu dispatches, %zu us running, "
+	   "%zu us waiting\n", n, faults, dispatches, cpu_ns / 1000,
+	   wait_ns / 1000);
+}
+
 int
 pcb_has_next_instruction (struct PCB *pcb)
 {
@@ -16,6 +166,23 @@ pcb_has_next_instruction (struct PCB *pcb)
   return pcb->pc < pcb->line_count;
 }
 
+size_t
+pcb_stride (const struct PCB *pcb)
+{
+  return STRIDE1 / (pcb->tickets ? pcb->tickets : 1);
+}
+
+// Free the lines read by load_process that didn't end up in the frame store.
+static void
+free_lines (char **lines, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    {
+      free (lines[i]);
+    }
+  free (lines);
+}
+
 // Helper function to find a free frame
 int
 find_free_frame ()
@@ -61,10 +228,56 @@ pick_victim_lru ()
   return lru_frame;
 }
 
-// Helper function to update victim's owner page table
+// Point every page of pcb that is in frame at -1, so that it faults the
+// page back in the next time it needs it, rather than reading whatever
+// gets loaded into the frame next.
+static void
+forget_frame (struct PCB *pcb, int frame)
+{
+  for (size_t page = 0; page < pcb->page_count; page++)
+    {
+      if (pcb->page_table[page] == frame)
+	pcb->page_table[page] = -1;
+    }
+}
+
+// A process in the table, other than the owner, whose page table maps
+// frame: a clone sharing the owner's pages (see clone_pcb), or NULL.
+// Caller holds the frame store lock.
+static struct PCB *
+find_frame_sharer (int frame, struct PCB *owner)
+{
+  struct PCB *sharer = NULL;
+  pthread_mutex_lock (&process_table_lock);
+  for (struct PCB * p = process_table; p && !sharer; p = p->table_next)
+    {
+      for (size_t page = 0; p != owner && page < p->page_count; page++)
+	{
+	  if (p->page_table[page] == frame)
+	    {
+	      sharer = p;
+	      break;
+	    }
+	}
+    }
+  pthread_mutex_unlock (&process_table_lock);
+  return sharer;
+}
+
+// Helper function to update the page tables that map the victim frame
 void
 update_victim_owner (int frame)
 {
+  // Clones share the owner's frames, so every process that maps this one
+  // has to forget it, not just the owner.
+  struct PCB *owner = frame_store[frame].lines[0].owner;
+  if (owner)
+    forget_frame (owner, frame);
+  pthread_mutex_lock (&process_table_lock);
+  for (struct PCB * p = process_table; p; p = p->table_next)
+    forget_frame (p, frame);
+  pthread_mutex_unlock (&process_table_lock);
+
   // Free the lines in the victim frame
   for (int i = 0; i < FRAME_SIZE; i++)
     {
@@ -95,6 +308,9 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
     {
       // no free frame => pick a victim using LRU
       frame = pick_victim_lru ();
+      // Hold stdout across the whole report, so that a script running on
+      // another worker can't print into the middle of it.
+      flockfile (stdout);
       printf ("Page fault! ");
       printf ("Victim page contents:\n\n");
       for (int i = 0; i < FRAME_SIZE; i++)
@@ -105,8 +321,11 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
 	    }
 	}
       printf ("\nEnd of victim page contents.\n");
+      funlockfile (stdout);
 
       // Free the victim frame's contents
+      struct PCB *owner = frame_store[frame].lines[0].owner;
+      trace_event (TRACE_EVICT, owner ? owner->pid : 0, frame, NULL);
       update_victim_owner (frame);
     }
   else
@@ -114,6 +333,7 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
       // Just a page fault with free frame available
       printf ("Page fault!\n");
     }
+  pcb_stat_add (&pcb->faults, 1);
 
   // Check if frame is valid
   if (frame < 0 || frame >= NUM_FRAMES)
@@ -125,21 +345,27 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
   // Update the timestamp for this frame
   frame_store[frame].last_access_time = get_current_time ();
 
-  // 3) Load the page from disk. We'll open the file, skip pages that came before:
-  FILE *f = fopen (pcb->name, "r");
-  if (!f)
-    {
-      perror ("handle_page_fault: Could not re-open file");
-      // handle error
-      return;
-    }
-
-  // skip (page_index * FRAME_SIZE) lines
+  // 3) Load the page. A process with a file name re-opens it and skips
+  //    the pages that came before; the shell input reads its own copy.
+  FILE *f = NULL;
   char buffer[MAX_USER_INPUT];
-  for (int i = 0; i < (int) page_index * FRAME_SIZE; i++)
+  if (!pcb->source_lines)
     {
-      if (!fgets (buffer, MAX_USER_INPUT, f))
-	break;
+      f = fopen (pcb->name, "r");
+      if (!f)
+	{
+	  // Trying again would only fail the same way.
+	  perror ("handle_page_fault: Could not re-open file");
+	  pcb_end (pcb);
+	  return;
+	}
+
+      // skip (page_index * FRAME_SIZE) lines
+      for (int i = 0; i < (int) page_index * FRAME_SIZE; i++)
+	{
+	  if (!fgets (buffer, MAX_USER_INPUT, f))
+	    break;
+	}
     }
 
   // read up to FRAME_SIZE lines
@@ -154,7 +380,14 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
 	  frame_store[frame].lines[j].owner = NULL;
 	}
 
-      if (!fgets (buffer, MAX_USER_INPUT, f))
+      if (pcb->source_lines)
+	{
+	  size_t line = page_index * FRAME_SIZE + j;
+	  if (line >= pcb->line_count)
+	    continue;
+	  strcpy (buffer, pcb->source_lines[line]);
+	}
+      else if (!fgets (buffer, MAX_USER_INPUT, f))
 	{
 	  // no more lines => empty slot
 	  continue;
@@ -169,12 +402,19 @@ handle_page_fault (struct PCB *pcb, size_t page_index)
       frame_store[frame].lines[j].owner = pcb;
       pcb->duration++;
     }
-  fclose (f);
+  if (f)
+    fclose (f);
 
   // 4) Update the page table for this page
   pcb->page_table[page_index] = frame;
 }
 
+void
+pcb_end (struct PCB *pcb)
+{
+  pcb_stat_set (&pcb->pc, pcb->line_count);
+}
+
 size_t
 pcb_next_instruction (struct PCB *pcb)
 {
@@ -186,7 +426,9 @@ pcb_next_instruction (struct PCB *pcb)
       // page fault!
       // we typically just return a special "PAGEFAULT" code or do
       // something that your scheduler can see. We'll do it inline:
+      trace_event (TRACE_FAULT_BEGIN, pcb->pid, -1, NULL);
       handle_page_fault (pcb, page);
+      trace_event (TRACE_FAULT_END, pcb->pid, pcb->page_table[page], NULL);
       // Return -1 to indicate that the process needs to be rescheduled
       // This will signal the scheduler to move the process to the back of the ready queue
       return (size_t) -1;
@@ -207,7 +449,7 @@ pcb_next_instruction (struct PCB *pcb)
 
   // Calculate actual line index
   size_t line_index = frame * FRAME_SIZE + offset;
-  pcb->pc++;
+  pcb_stat_add (&pcb->pc, 1);
   return line_index;
 }
 
@@ -215,6 +457,9 @@ struct PCB *
 clone_pcb (struct PCB *pcb)
 {
   struct PCB *new_pcb = malloc (sizeof (struct PCB));
+  // The original may be faulting pages in on another worker while we copy
+  // its page table.
+  lock_frame_store ();
   new_pcb->pid = fresh_pid++;
   new_pcb->name = strdup (pcb->name);
   new_pcb->next = NULL;
@@ -222,6 +467,15 @@ clone_pcb (struct PCB *pcb)
   new_pcb->line_base = pcb->line_base;
   new_pcb->line_count = pcb->line_count;
   new_pcb->duration = pcb->duration;
+  new_pcb->level = 0;
+  new_pcb->tickets = DEFAULT_TICKETS;
+  new_pcb->pass = 0;
+  new_pcb->deadline = NO_DEADLINE;
+  new_pcb->vruntime = 0;
+  new_pcb->slice = 0;
+  // Only processes with a file name are cloned.
+  new_pcb->source_lines = NULL;
+  init_accounting (new_pcb);
 
   // Clone the page table
   new_pcb->page_count = pcb->page_count;
@@ -231,11 +485,35 @@ clone_pcb (struct PCB *pcb)
       memcpy (new_pcb->page_table, pcb->page_table,
 	      sizeof (int) * pcb->page_count);
     }
+  unlock_frame_store ();
 
   new_pcb->next = NULL;
   return new_pcb;
 }
 
+struct PCB *
+clone_process_named (const char *name)
+{
+  // Once we let go of the process table, the original could finish on
+  // another worker; but free_pcb needs the frame store lock too, so
+  // holding it keeps the original around until our clone is made (and
+  // is in the table, ready to take the original's pages over).
+  lock_frame_store ();
+  struct PCB *original = NULL;
+  pthread_mutex_lock (&process_table_lock);
+  for (struct PCB * p = process_table; p && !original; p = p->table_next)
+    {
+      if (strcmp (p->name, name) == 0)
+	original = p;
+    }
+  pthread_mutex_unlock (&process_table_lock);
+  struct PCB *clone = original ? clone_pcb (original) : NULL;
+  unlock_frame_store ();
+  return clone;
+}
+
+static struct PCB *load_process (FILE * script, int keep_source);
+
 struct PCB *
 create_process (const char *filename)
 {
@@ -252,7 +530,11 @@ create_process (const char *filename)
       perror ("failed to open file for create_process");
       return NULL;
     }
-  struct PCB *pcb = create_process_from_FILE (script);
+  // The rest of the pages will be faulted in from the file when they're
+  // needed.
+  struct PCB *pcb = load_process (script, 0);
+  if (!pcb)
+    return NULL;
   // Update the pcb name according to the filename we received.
   pcb->name = strdup (filename);
   return pcb;
@@ -260,6 +542,16 @@ create_process (const char *filename)
 
 struct PCB *
 create_process_from_FILE (FILE * script)
+{
+  // We have no way to re-read this file on a page fault (it's usually
+  // stdin), so the process keeps its own copy of the lines to page from.
+  return load_process (script, 1);
+}
+
+// Read script into a new process and load its first two pages. If
+// keep_source, the lines are kept in pcb->source_lines for later faults.
+static struct PCB *
+load_process (FILE * script, int keep_source)
 {
 
   // We can open the file, so we'll be making a process.
@@ -280,6 +572,7 @@ create_process_from_FILE (FILE * script)
   pcb->pc = 0;
   pcb->page_count = 0;
   pcb->page_table = NULL;	// will be allocated after loading pages
+  pcb->source_lines = NULL;
 
   // create initial values for base and count, in case we fail to read
   // any lines from the file. That way we'll end up with an empty process
@@ -290,6 +583,13 @@ create_process_from_FILE (FILE * script)
   pcb->line_count = 0;
   pcb->line_base = 0;
   pcb->duration = 0;		// Initialize duration to 0
+  pcb->level = 0;
+  pcb->tickets = DEFAULT_TICKETS;
+  pcb->pass = 0;
+  pcb->deadline = NO_DEADLINE;
+  pcb->vruntime = 0;
+  pcb->slice = 0;
+  init_accounting (pcb);
 
   // We're told to assume lines of files are limited to 100 characters.
   // That's all well and good, but for implementing # we need to read
@@ -297,11 +597,27 @@ create_process_from_FILE (FILE * script)
   // It's unclear if we should assume it's also limited to 100 for this
   // purpose. If you did assume that, that's OK! We didn't.
   char linebuf[MAX_USER_INPUT];
+  char **lines = NULL;
+  size_t lines_cap = 0;
 
-  // First pass: count total lines to determine total pages needed
+  // First pass: read every line, which also tells us how many pages we
+  // need. We keep them rather than rewinding and reading again, because the
+  // script may be stdin: rewinding would go back to before the exec
+  // command that got us here, and a pipe can't be rewound at all.
   while (fgets (linebuf, MAX_USER_INPUT, script))
     {
-      pcb->line_count++;
+      // Remove trailing newline if present
+      size_t len = strlen (linebuf);
+      if (len > 0 && linebuf[len - 1] == '\n')
+	{
+	  linebuf[len - 1] = '\0';
+	}
+      if (pcb->line_count == lines_cap)
+	{
+	  lines_cap = lines_cap ? 2 * lines_cap : 16;
+	  lines = realloc (lines, sizeof (char *) * lines_cap);
+	}
+      lines[pcb->line_count++] = strdup (linebuf);
     }
 
   // Calculate total pages needed (ceiling of line_count/FRAME_SIZE)
@@ -312,6 +628,7 @@ create_process_from_FILE (FILE * script)
   if (!pcb->page_table)
     {
       perror ("malloc failed for page_table");
+      free_lines (lines, pcb->line_count);
       free_pcb (pcb);
       fclose (script);
       return NULL;
@@ -323,11 +640,16 @@ create_process_from_FILE (FILE * script)
       pcb->page_table[i] = -1;
     }
 
-  // Reset file pointer to beginning
-  fseek (script, 0, SEEK_SET);
+  if (keep_source)
+    {
+      // free_pcb releases these from now on.
+      pcb->source_lines = lines;
+      lines = NULL;
+    }
 
   // Load only the first two pages (or one if program is smaller)
   size_t pages_to_load = (pcb->page_count < 2) ? pcb->page_count : 2;
+  lock_frame_store ();
   for (size_t page = 0; page < pages_to_load; page++)
     {
       // Allocate a frame in the first available hole
@@ -335,7 +657,12 @@ create_process_from_FILE (FILE * script)
       if (frame == -1)
 	{
 	  fprintf (stderr, "Out of frame store memory\n");
+	  // free_pcb frees pcb, so free the lines while we still know how
+	  // many there are.
+	  if (lines)
+	    free_lines (lines, pcb->line_count);
 	  free_pcb (pcb);
+	  unlock_frame_store ();
 	  fclose (script);
 	  return NULL;
 	}
@@ -344,20 +671,25 @@ create_process_from_FILE (FILE * script)
       // Load lines for this page
       for (int offset = 0; offset < FRAME_SIZE; offset++)
 	{
-	  if (!fgets (linebuf, MAX_USER_INPUT, script))
+	  size_t line = page * FRAME_SIZE + offset;
+	  if (line >= pcb->line_count)
 	    {
 	      break;		// End of file
 	    }
 
-	  // Remove trailing newline if present
-	  size_t len = strlen (linebuf);
-	  if (len > 0 && linebuf[len - 1] == '\n')
+	  // The frame store takes ownership of the string, or of a copy if
+	  // the process is keeping the original.
+	  frame_store[frame].lines[offset].allocated = 1;
+	  if (lines)
 	    {
-	      linebuf[len - 1] = '\0';
+	      frame_store[frame].lines[offset].line = lines[line];
+	      lines[line] = NULL;
+	    }
+	  else
+	    {
+	      frame_store[frame].lines[offset].line =
+		strdup (pcb->source_lines[line]);
 	    }
-
-	  frame_store[frame].lines[offset].allocated = 1;
-	  frame_store[frame].lines[offset].line = strdup (linebuf);
 	  frame_store[frame].lines[offset].owner = pcb;
 	  pcb->duration++;
 	}
@@ -365,8 +697,11 @@ create_process_from_FILE (FILE * script)
       // Initialize the timestamp for this frame
       frame_store[frame].last_access_time = get_current_time ();
     }
+  unlock_frame_store ();
 
   // We're done with the file, don't forget to close it!
+  if (lines)
+    free_lines (lines, pcb->line_count);
   fclose (script);
 
   // For backward compatibility, define line_base as the global index
@@ -382,8 +717,11 @@ create_process_from_FILE (FILE * script)
 void
 free_pcb (struct PCB *pcb)
 {
+  pthread_mutex_lock (&process_table_lock);
+  unlink_process (pcb);
+  pthread_mutex_unlock (&process_table_lock);
 
-
+  lock_frame_store ();
   // Free all frames used by this PCB
   for (size_t i = 0; i < pcb->page_count; i++)
     {
@@ -391,12 +729,22 @@ free_pcb (struct PCB *pcb)
       if (frame == -1)
 	continue;		// Skip unloaded pages
 
+      // If a clone is still using the page, it takes the lines over.
+      struct PCB *heir = NULL;
+      if (frame_store[frame].lines[0].owner == pcb)
+	heir = find_frame_sharer (frame, pcb);
+
       // Free only the lines owned by this PCB
       for (int j = 0; j < FRAME_SIZE; j++)
 	{
 	  if (frame_store[frame].lines[j].allocated &&
 	      frame_store[frame].lines[j].owner == pcb)
 	    {
+	      if (heir)
+		{
+		  frame_store[frame].lines[j].owner = heir;
+		  continue;
+		}
 	      free (frame_store[frame].lines[j].line);
 	      frame_store[frame].lines[j].allocated = 0;
 	      frame_store[frame].lines[j].line = NULL;
@@ -404,12 +752,17 @@ free_pcb (struct PCB *pcb)
 	    }
 	}
     }
+  unlock_frame_store ();
 
   // Free the page table
   if (pcb->page_table)
     {
       free (pcb->page_table);
     }
+  if (pcb->source_lines)
+    {
+      free_lines (pcb->source_lines, pcb->line_count);
+    }
 
   // Free the process name, but only if it's not the empty string
   if (strcmp ("", pcb->name))
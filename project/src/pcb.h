@@ -31,6 +31,43 @@ struct PCB
   // the same value as line_count.
   size_t duration;
 
+  // MLFQ priority level; 0 is the highest. Starts at 0, and is only
+  // changed by the MLFQ policy (see schedule_policy.c).
+  size_t level;
+
+  // Proportional share, for STRIDE and LOTTERY. tickets defaults to
+  // DEFAULT_TICKETS and can be given on the exec line as `prog:tickets`.
+  // pass is 0 until STRIDE first enqueues the process, and from then on
+  // grows by pcb_stride(pcb) for every instruction it runs.
+  size_t tickets;
+  size_t pass;
+
+  // EDF: absolute deadline on the instruction_clock (see interpreter.h),
+  // or NO_DEADLINE. Given on the exec line as `prog@N`, meaning N
+  // instructions after the exec.
+  size_t deadline;
+
+  // CFS: virtual runtime, in thousandths of an instruction at
+  // DEFAULT_TICKETS weight. A process with twice the tickets accrues it
+  // half as fast. slice is how many instructions CFS will run it for the
+  // next time it is dispatched; dequeue_cfs sets it.
+  size_t vruntime;
+  size_t slice;
+
+  // Accounting, for ps and the summary printed after each exec. Times are
+  // in nanoseconds, as given by pcb_now_ns. The run_pcb_* functions in
+  // interpreter.c keep these up to date, except faults, which
+  // handle_page_fault counts. Only the thread running the process writes
+  // them, but ps reads them (and pc) from another, so writes go through
+  // pcb_stat_add and pcb_stat_set.
+  size_t arrival_ns;		// when the process was created
+  size_t ready_since_ns;	// when it last became ready; 0 while running
+  size_t cpu_ns;		// time spent running its instructions
+  size_t wait_ns;		// time spent ready, waiting to be dispatched
+  size_t instructions;		// instructions executed
+  size_t faults;		// page faults taken
+  size_t dispatches;		// times it has been given the CPU
+
   // pc is the number of the instruction next to execute.
   // For example, it is initially 0, **regardless** of the value of
   // line_base. (Think of it as the "virtual address" of the next insn.)
@@ -47,18 +84,55 @@ struct PCB
   struct PCB *next;
   size_t page_count;
   int *page_table;
+  // A process read from a FILE* (the shell input, for #) can't re-open it
+  // to fault pages in, so it keeps a copy of every line here instead, and
+  // pages are loaded from this. NULL for processes that have a file name.
+  char **source_lines;
+
+  // Links every PCB that hasn't finished yet, for ps. See retire_pcb.
+  struct PCB *table_next;
 };
 
+// Relaxed atomic updates of a PCB's accounting fields: the writer doesn't
+// need to wait for anyone, and ps can't see a torn value.
+static inline void
+pcb_stat_add (size_t *stat, size_t n)
+{
+  __atomic_store_n (stat, *stat + n, __ATOMIC_RELAXED);
+}
+
+static inline void
+pcb_stat_set (size_t *stat, size_t value)
+{
+  __atomic_store_n (stat, value, __ATOMIC_RELAXED);
+}
+
+#define DEFAULT_TICKETS 100
+#define NO_DEADLINE ((size_t) -1)
+// Larger strides mean a smaller share. STRIDE1 is big so that rounding
+// in the division doesn't noticeably skew shares.
+#define STRIDE1 ((size_t) 1 << 20)
+
 // Returns non-zero iff there are more instructions to execute.
 int pcb_has_next_instruction (struct PCB *pcb);
+// STRIDE1 / tickets (tickets of 0 are treated as 1).
+size_t pcb_stride (const struct PCB *pcb);
 // Get the shellmemory index of the next instruction, and increment pc.
+// The caller must hold the frame store lock (see shellmemory.h), and the
+// index is only meaningful until it is released.
 size_t pcb_next_instruction (struct PCB *pcb);
+// End pcb early, e.g. because one of its pages couldn't be loaded. It then
+// has no next instruction, so whoever is running it retires and frees it
+// as though it had finished, rather than putting it back on the queue.
+void pcb_end (struct PCB *pcb);
 // Create a new process from the given filename:
 //   1. Allocates a new PCB
 //   2. Loads the code from the script file into shellmemory
 //   3. Does NOT enqueue the PCB to any scheduling queue (next is NULL)
 struct PCB *create_process (const char *filename);
-// Like create_process, but takes a FILE* directly.
+// Like create_process, but takes a FILE* directly, reading from its current
+// position. Since the FILE* can't be re-read later, the lines are kept in
+// pcb->source_lines, and pages are faulted in from there.
 // Ownership of the FILE* is taken and it will be closed.
 struct PCB *create_process_from_FILE (FILE * f);
 // Cleanup a process:
@@ -68,3 +142,20 @@ void free_pcb (struct PCB *pcb);
 
 
 struct PCB *clone_pcb (struct PCB *pcb);
+// If an unfinished process is running the program called name, return a
+// clone of it that shares its pages; otherwise NULL. This looks at the
+// process table, so it finds processes wherever they are: on any queue,
+// including MT workers' local ones, or running.
+struct PCB *clone_process_named (const char *name);
+
+// Monotonic wall clock time, for the accounting fields.
+size_t pcb_now_ns (void);
+// Record that pcb has finished: take it out of the process table, and keep
+// its accounting for the next print_process_summary. Call this once the
+// process has no more instructions, before it's freed.
+void retire_pcb (struct PCB *pcb);
+// Print the accounting of every unfinished process (the `ps` builtin).
+void print_processes (FILE * out);
+// Print the accounting of every process retired since the last call, and
+// forget them.
+void print_process_summary (FILE * out);
@@ -1,9 +1,18 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include "interpreter.h"	// current_process, request_preemption
 #include "pcb.h"
 #include "queue.h"
 
+struct heap_entry
+{
+  struct PCB *pcb;
+  size_t key;
+  // Insertion order, used to break ties FCFS.
+  size_t seq;
+};
+
 struct queue
 {
   struct PCB *head;
@@ -13,6 +22,28 @@ struct queue
   // On the other hand, properly implementing the bookkeeping for a tail
   // pointer is headache-inducing!
   //struct PCB *tail;
+
+  // Proportional-share policies are meant for batches much bigger than 4,
+  // so they keep their PCBs in a binary min-heap instead, which makes
+  // both enqueue and dequeue O(log n). The list above is still used for
+  // enqueue_ignoring_priority, and whatever is on it comes out first.
+  struct heap_entry *heap;
+  size_t heap_len;
+  size_t heap_cap;
+  size_t heap_seq;
+  // Sum of the tickets of every PCB on the heap.
+  size_t heap_weight;
+
+  // STRIDE: the pass value of the process dequeued most recently.
+  // Newcomers start from here so they can't monopolize the CPU.
+  size_t global_pass;
+  // CFS: never decreases; the smallest vruntime that has been dequeued.
+  size_t min_vruntime;
+  // LOTTERY: state for rand_r. Fixed, so that runs are reproducible.
+  unsigned int lottery_seed;
+
+  // Number of dequeues so far; MLFQ uses it to schedule priority boosts.
+  size_t dispatches;
 };
 
 // INVARIANT:
@@ -23,6 +54,15 @@ alloc_queue ()
 {
   struct queue *q = malloc (sizeof (struct queue));
   q->head = NULL;
+  q->heap = NULL;
+  q->heap_len = 0;
+  q->heap_cap = 0;
+  q->heap_seq = 0;
+  q->heap_weight = 0;
+  q->global_pass = 0;
+  q->min_vruntime = 0;
+  q->lottery_seed = 310;
+  q->dispatches = 0;
   return q;
 }
 
@@ -41,38 +81,14 @@ free_queue (struct queue *q)
       printf ("freeing pcb 1\n");
       p = next;
     }
-  free (q);
-}
-
-int
-program_already_scheduled (struct queue *q, char *name)
-{
-  struct PCB *p = q->head;
-  while (p)
-    {
-      if (strcmp (p->name, name) == 0)
-	return 1;
-      p = p->next;
-    }
-  return 0;
-}
-
-struct PCB *
-pass_clone (struct queue *q, char *name)
-{
-  struct PCB *p = q->head;
-  while (p)
+  for (size_t i = 0; i < q->heap_len; ++i)
     {
-      if (strcmp (p->name, name) == 0)
-	{
-	  return clone_pcb (p);
-	}
-      p = p->next;
+      free_pcb (q->heap[i].pcb);
     }
-  return NULL;
+  free (q->heap);
+  free (q);
 }
 
-
 void
 enqueue_ignoring_priority (struct queue *q, struct PCB *pcb)
 {
@@ -104,15 +120,18 @@ enqueue_fcfs (struct queue *q, struct PCB *pcb)
   p->next = pcb;
 }
 
-void
-enqueue_sjf (struct queue *q, struct PCB *pcb)
+// Insert pcb in front of the first PCB with a strictly larger key,
+// so that ties are broken FCFS.
+static void
+enqueue_ordered (struct queue *q, struct PCB *pcb,
+		 size_t (*key) (const struct PCB *))
 {
-  size_t dur = pcb->duration;
+  size_t dur = key (pcb);
 
   struct PCB *p = q->head;
   // if the queue was empty, or the head is a longer job than pcb,
   // pcb is just the new head.
-  if (!p || p->duration > dur)
+  if (!p || key (p) > dur)
     {
       pcb->next = p;
       q->head = pcb;
@@ -124,7 +143,7 @@ enqueue_sjf (struct queue *q, struct PCB *pcb)
   // p and p->next. Otherwise, step and try again.
   while (p->next)
     {
-      if (p->next->duration > dur)
+      if (key (p->next) > dur)
 	{
 	  pcb->next = p->next;
 	  p->next = pcb;
@@ -136,6 +155,30 @@ enqueue_sjf (struct queue *q, struct PCB *pcb)
   p->next = pcb;
 }
 
+static size_t
+duration_of (const struct PCB *pcb)
+{
+  return pcb->duration;
+}
+
+static size_t
+level_of (const struct PCB *pcb)
+{
+  return pcb->level;
+}
+
+void
+enqueue_sjf (struct queue *q, struct PCB *pcb)
+{
+  enqueue_ordered (q, pcb, duration_of);
+}
+
+void
+enqueue_mlfq (struct queue *q, struct PCB *pcb)
+{
+  enqueue_ordered (q, pcb, level_of);
+}
+
 void
 enqueue_aging (struct queue *q, struct PCB *pcb)
 {
@@ -181,9 +224,285 @@ dequeue_typical (struct queue *q)
   q->head = head->next;
 
   head->next = NULL;
+  q->dispatches++;
   return head;
 }
 
+struct PCB *
+dequeue_mlfq (struct queue *q)
+{
+  struct PCB *r = dequeue_typical (q);
+
+  // Periodically move everything back to the top level, so that processes
+  // which were demoted for being CPU-bound can't be starved by a steady
+  // stream of short ones. Since every level becomes 0, the queue stays
+  // sorted in the order it is already in.
+  if (r && q->dispatches % MLFQ_BOOST_INTERVAL == 0)
+    {
+      r->level = 0;
+      for (struct PCB *p = q->head; p; p = p->next)
+	{
+	  p->level = 0;
+	}
+    }
+
+  return r;
+}
+
+struct PCB *
+steal_pcb (struct queue *q)
+{
+  // The last heap entry is a leaf, so removing it keeps the heap valid,
+  // and it's near the back of the line anyway.
+  if (q->heap_len > 0)
+    {
+      struct PCB *leaf = q->heap[--q->heap_len].pcb;
+      q->heap_weight -= leaf->tickets;
+      return leaf;
+    }
+
+  struct PCB *p = q->head;
+  if (!p)
+    {
+      return NULL;
+    }
+  if (!p->next)
+    {
+      q->head = NULL;
+      return p;
+    }
+
+  // Walk to the second-to-last PCB, and unlink its successor.
+  while (p->next->next)
+    {
+      p = p->next;
+    }
+  struct PCB *tail = p->next;
+  p->next = NULL;
+  return tail;
+}
+
+// ---------------------
+// Binary min-heap, for the proportional-share policies.
+// ---------------------
+
+static int
+heap_less (const struct heap_entry *a, const struct heap_entry *b)
+{
+  return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+static void
+heap_swap (struct queue *q, size_t i, size_t j)
+{
+  struct heap_entry tmp = q->heap[i];
+  q->heap[i] = q->heap[j];
+  q->heap[j] = tmp;
+}
+
+static void
+heap_push (struct queue *q, struct PCB *pcb, size_t key)
+{
+  if (q->heap_len == q->heap_cap)
+    {
+      q->heap_cap = q->heap_cap ? 2 * q->heap_cap : 8;
+      q->heap = realloc (q->heap, sizeof (struct heap_entry) * q->heap_cap);
+    }
+
+  size_t i = q->heap_len++;
+  q->heap[i].pcb = pcb;
+  q->heap[i].key = key;
+  q->heap[i].seq = q->heap_seq++;
+  q->heap_weight += pcb->tickets;
+
+  // sift up
+  while (i > 0 && heap_less (&q->heap[i], &q->heap[(i - 1) / 2]))
+    {
+      heap_swap (q, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+}
+
+static struct PCB *
+heap_pop (struct queue *q)
+{
+  if (q->heap_len == 0)
+    {
+      return NULL;
+    }
+
+  struct PCB *min = q->heap[0].pcb;
+  q->heap[0] = q->heap[--q->heap_len];
+  q->heap_weight -= min->tickets;
+
+  // sift down
+  size_t i = 0;
+  while (1)
+    {
+      size_t l = 2 * i + 1, r = l + 1, smallest = i;
+      if (l < q->heap_len && heap_less (&q->heap[l], &q->heap[smallest]))
+	smallest = l;
+      if (r < q->heap_len && heap_less (&q->heap[r], &q->heap[smallest]))
+	smallest = r;
+      if (smallest == i)
+	break;
+      heap_swap (q, i, smallest);
+      i = smallest;
+    }
+
+  min->next = NULL;
+  return min;
+}
+
+void
+enqueue_stride (struct queue *q, struct PCB *pcb)
+{
+  // A process that has never run joins at the current pass, plus one stride
+  // as though it had just been charged for its first slice.
+  if (pcb->pass == 0)
+    {
+      pcb->pass = q->global_pass + pcb_stride (pcb);
+    }
+  heap_push (q, pcb, pcb->pass);
+}
+
+struct PCB *
+dequeue_stride (struct queue *q)
+{
+  if (q->head)
+    {
+      return dequeue_typical (q);
+    }
+
+  struct PCB *r = heap_pop (q);
+  if (r)
+    {
+      q->global_pass = r->pass;
+      q->dispatches++;
+    }
+  return r;
+}
+
+void
+enqueue_cfs (struct queue *q, struct PCB *pcb)
+{
+  // Newcomers start level with everyone else, rather than at 0 where
+  // they would hog the CPU until they caught up.
+  if (pcb->vruntime < q->min_vruntime)
+    {
+      pcb->vruntime = q->min_vruntime;
+    }
+  heap_push (q, pcb, pcb->vruntime);
+}
+
+struct PCB *
+dequeue_cfs (struct queue *q)
+{
+  struct PCB *r;
+  if (q->head)
+    {
+      r = dequeue_typical (q);
+    }
+  else
+    {
+      r = heap_pop (q);
+      if (!r)
+	return NULL;
+      q->dispatches++;
+      if (r->vruntime > q->min_vruntime)
+	q->min_vruntime = r->vruntime;
+    }
+
+  // Everyone runnable should get a turn every CFS_LATENCY instructions,
+  // each in proportion to its weight, but never less than the minimum
+  // granularity so that switching doesn't dominate.
+  size_t total = q->heap_weight + r->tickets;
+  r->slice = total ? CFS_LATENCY * r->tickets / total : CFS_LATENCY;
+  if (r->slice < CFS_MIN_GRANULARITY)
+    {
+      r->slice = CFS_MIN_GRANULARITY;
+    }
+  return r;
+}
+
+static size_t
+remaining_of (const struct PCB *pcb)
+{
+  return pcb->line_count - pcb->pc;
+}
+
+void
+enqueue_srtf (struct queue *q, struct PCB *pcb)
+{
+  // If a running script just exec'd something shorter than what it has
+  // left to do itself, it should give up the CPU right away.
+  struct PCB *running = current_process ();
+  if (running && running != pcb && remaining_of (pcb) < remaining_of (running))
+    {
+      request_preemption ();
+    }
+  heap_push (q, pcb, remaining_of (pcb));
+}
+
+// EDF uses this too: the only difference is the heap key.
+struct PCB *
+dequeue_srtf (struct queue *q)
+{
+  if (q->head)
+    {
+      return dequeue_typical (q);
+    }
+
+  struct PCB *r = heap_pop (q);
+  if (r)
+    {
+      q->dispatches++;
+    }
+  return r;
+}
+
+void
+enqueue_edf (struct queue *q, struct PCB *pcb)
+{
+  // Like SRTF, an arrival that's more urgent than the running script
+  // preempts it.
+  struct PCB *running = current_process ();
+  if (running && running != pcb && pcb->deadline < running->deadline)
+    {
+      request_preemption ();
+    }
+  heap_push (q, pcb, pcb->deadline);
+}
+
+struct PCB *
+dequeue_lottery (struct queue *q)
+{
+  size_t total = 0;
+  for (struct PCB *p = q->head; p; p = p->next)
+    {
+      total += p->tickets;
+    }
+  if (total == 0)
+    {
+      return dequeue_typical (q);
+    }
+
+  // Walk the list until we reach the holder of the winning ticket.
+  size_t winner = rand_r (&q->lottery_seed) % total;
+  struct PCB **link = &q->head;
+  while (winner >= (*link)->tickets)
+    {
+      winner -= (*link)->tickets;
+      link = &(*link)->next;
+    }
+
+  struct PCB *r = *link;
+  *link = r->next;
+  r->next = NULL;
+  q->dispatches++;
+  return r;
+}
+
 #ifdef NDEBUG
 #define debug_with_age(q)
 #else
@@ -51,11 +51,6 @@ struct queue;
 struct queue *alloc_queue ();
 void free_queue (struct queue *q);
 
-// To determine if processes have the same name, we need a way of scanning
-// the queue contents for a given filename.
-int program_already_scheduled (struct queue *q, char *name);
-
-struct PCB *pass_clone (struct queue *q, char *name);
 // This particular function is policy-agnostic, but its interface matches
 // the regular enqueue function just to keep things clean.
 void enqueue_ignoring_priority (struct queue *q, struct PCB *pcb);
@@ -64,12 +59,56 @@ void enqueue_ignoring_priority (struct queue *q, struct PCB *pcb);
 void enqueue_fcfs (struct queue *q, struct PCB *pcb);
 // SJF
 void enqueue_sjf (struct queue *q, struct PCB *pcb);
+// MLFQ: ordered by level, FCFS within a level.
+void enqueue_mlfq (struct queue *q, struct PCB *pcb);
 // Aging
 // enqueue_sjf is almost correct, but we should leave the given pcb at the head
 // if it's tied with the current head, rather than doing an FCFS tiebreak.
 void enqueue_aging (struct queue *q, struct PCB *pcb);
 
+// Remove and return the PCB at the *tail* of the queue, i.e. the one the
+// policy would run last, or NULL if the queue is empty. Used by MT workers
+// to steal work from each other (see workers.c) without disturbing the
+// order the victim is about to run things in.
+struct PCB *steal_pcb (struct queue *q);
+
 // FCFS, RR, SJF
 struct PCB *dequeue_typical (struct queue *q);
 // Aging
 struct PCB *dequeue_aging (struct queue *q);
+// STRIDE
+// Ordered by pcb->pass, using a heap rather than the list, so both are
+// O(log n). PCBs put at the head with enqueue_ignoring_priority still come
+// out first. A PCB that has never been scheduled (pass == 0) starts one
+// stride past the pass of the most recently dequeued PCB.
+void enqueue_stride (struct queue *q, struct PCB *pcb);
+struct PCB *dequeue_stride (struct queue *q);
+// CFS
+// Also heap-based, ordered by pcb->vruntime. Enqueue lifts a newcomer's
+// vruntime to the queue's minimum. Dequeue sets the slice the PCB should
+// run for: its weighted share of CFS_LATENCY instructions, but at least
+// CFS_MIN_GRANULARITY.
+#define CFS_LATENCY 12
+#define CFS_MIN_GRANULARITY 2
+void enqueue_cfs (struct queue *q, struct PCB *pcb);
+struct PCB *dequeue_cfs (struct queue *q);
+// SRTF
+// Heap-based, ordered by remaining instructions (line_count - pc).
+// If the process running on this thread enqueues a PCB with less work
+// remaining than itself, it is preempted.
+void enqueue_srtf (struct queue *q, struct PCB *pcb);
+struct PCB *dequeue_srtf (struct queue *q);
+// EDF (dequeue with dequeue_srtf)
+// Heap-based, ordered by pcb->deadline; processes without one go last.
+// Preempts the running process for an arrival with an earlier deadline.
+void enqueue_edf (struct queue *q, struct PCB *pcb);
+// LOTTERY (enqueue with enqueue_fcfs)
+// Draws a ticket uniformly from all PCBs on the queue, weighted by
+// pcb->tickets. This walks the list, so it's O(n); use STRIDE for big
+// batches.
+struct PCB *dequeue_lottery (struct queue *q);
+// MLFQ
+// Every MLFQ_BOOST_INTERVAL dequeues from q, every PCB on it (including the
+// one returned) is boosted back to level 0.
+#define MLFQ_BOOST_INTERVAL 20
+struct PCB *dequeue_mlfq (struct queue *q);
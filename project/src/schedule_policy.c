@@ -1,5 +1,11 @@
+#include <ctype.h>		// isdigit
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>		// strtoul
 #include <string.h>
+#include <time.h>		// clock_gettime
 #include "interpreter.h"
+#include "pcb.h"
 #include "schedule_policy.h"
 
 #define MAKE_PREEMPTIVE_FN(n)                        \
@@ -30,6 +36,153 @@ const struct schedule_policy RR = {
   .enqueue_ignoring_priority = enqueue_ignoring_priority
 };
 
+// RR:<n> -- a quantum chosen on the exec line. There's only ever one
+// top-level schedule running, so a single variable is enough, as long as
+// only the top-level exec sets it (see get_policy).
+static size_t rr_quantum = 2;
+
+struct PCB *
+run_steps_rr_quantum (struct PCB *pcb)
+{
+  return run_pcb_for_n_steps (pcb, rr_quantum);
+}
+
+const struct schedule_policy RR_N = {
+  .run_pcb = run_steps_rr_quantum,
+  .enqueue = enqueue_fcfs,
+  .dequeue = dequeue_typical,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+// RR:<n>ms -- a quantum of n milliseconds of wall clock time, so a slow
+// instruction (a `run`, or a page fault on a big file) can't hold up
+// everything else for longer than that.
+static long rr_slice_usec = 1000;
+
+struct PCB *
+run_steps_rr_time_slice (struct PCB *pcb)
+{
+  return run_pcb_for_time_slice (pcb, rr_slice_usec);
+}
+
+const struct schedule_policy RR_TIMED = {
+  .run_pcb = run_steps_rr_time_slice,
+  .enqueue = enqueue_fcfs,
+  .dequeue = dequeue_typical,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+// RR:auto -- the quantum is re-derived after every slice from what the
+// last slices cost. Short quanta give low latency, but if switching
+// between processes is expensive relative to running an instruction,
+// most of the time goes to switching. So we pick the smallest quantum
+// that keeps the switch overhead under 1/RR_AUTO_OVERHEAD_RATIO of the
+// slice. Then, if processes tend to fault long before they'd use that
+// quantum, we shrink it towards the typical run between faults: a
+// quantum nobody reaches only delays the processes waiting behind.
+#define RR_AUTO_MIN 1
+#define RR_AUTO_MAX 64
+#define RR_AUTO_OVERHEAD_RATIO 20
+// Weight of a new sample in the running averages, as 1/RR_AUTO_SMOOTHING.
+#define RR_AUTO_SMOOTHING 8
+
+// Measurements are per thread, so that MT workers each tune themselves
+// from their own slices without sharing (or racing on) any state.
+static __thread size_t auto_quantum = 2;
+static __thread struct timespec auto_last_end;
+// Running averages, in nanoseconds.
+static __thread double auto_switch_ns, auto_insn_ns;
+// Totals, for the average run length between faults.
+static __thread size_t auto_insns, auto_faults;
+
+static double
+elapsed_ns (const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1e9 + (to->tv_nsec - from->tv_nsec);
+}
+
+static double
+smooth (double average, double sample)
+{
+  if (average == 0)
+    return sample;
+  return average + (sample - average) / RR_AUTO_SMOOTHING;
+}
+
+// Forget everything measured by earlier schedules on this thread. In
+// particular, the first switch sample of a new schedule would otherwise
+// span the whole gap since the last one ended.
+static void
+reset_rr_auto (void)
+{
+  auto_quantum = 2;
+  auto_last_end = (struct timespec) { 0 };
+  auto_switch_ns = auto_insn_ns = 0;
+  auto_insns = auto_faults = 0;
+}
+
+struct PCB *
+run_steps_rr_auto (struct PCB *pcb)
+{
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  // Everything between the end of our last slice and now was spent
+  // switching: re-enqueueing, dequeueing, and so on.
+  if (auto_last_end.tv_sec || auto_last_end.tv_nsec)
+    {
+      auto_switch_ns = smooth (auto_switch_ns,
+			       elapsed_ns (&auto_last_end, &start));
+    }
+
+  size_t quantum = auto_quantum;
+  size_t start_pc = pcb->pc;
+  pcb = run_pcb_for_n_steps (pcb, quantum);
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  auto_last_end = end;
+
+  // If the process finished, we don't know how far it got in this slice;
+  // just skip this sample.
+  if (!pcb)
+    return NULL;
+
+  size_t ran = pcb->pc - start_pc;
+  if (ran > 0)
+    {
+      auto_insn_ns = smooth (auto_insn_ns, elapsed_ns (&start, &end) / ran);
+      auto_insns += ran;
+    }
+  if (ran < quantum)
+    {
+      // Stopped early with work left: that's a page fault.
+      auto_faults++;
+    }
+
+  if (auto_insn_ns > 0)
+    {
+      double q = RR_AUTO_OVERHEAD_RATIO * auto_switch_ns / auto_insn_ns;
+      if (auto_faults > 0)
+	{
+	  double between_faults = (double) auto_insns / auto_faults;
+	  if (q > between_faults)
+	    q = between_faults;
+	}
+      if (q < RR_AUTO_MIN)
+	q = RR_AUTO_MIN;
+      if (q > RR_AUTO_MAX)
+	q = RR_AUTO_MAX;
+      auto_quantum = (size_t) q;
+    }
+  return pcb;
+}
+
+const struct schedule_policy RR_AUTO = {
+  .run_pcb = run_steps_rr_auto,
+  .enqueue = enqueue_fcfs,
+  .dequeue = dequeue_typical,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
 const struct schedule_policy RR30 = {
   .run_pcb = run_steps_30,
   .enqueue = enqueue_fcfs,
@@ -37,6 +190,165 @@ const struct schedule_policy RR30 = {
   .enqueue_ignoring_priority = enqueue_ignoring_priority
 };
 
+// MLFQ levels, from highest priority to lowest, and the quantum
+// each one gets.
+#define MLFQ_LEVELS 3
+static const size_t mlfq_quantum[MLFQ_LEVELS] = { 2, 4, 8 };
+
+struct PCB *
+run_mlfq (struct PCB *pcb)
+{
+  size_t quantum = mlfq_quantum[pcb->level];
+  size_t start = pcb->pc;
+
+  pcb = run_pcb_for_n_steps (pcb, quantum);
+
+  // A process that used its whole quantum is CPU-bound: demote it.
+  // One that stopped early on a page fault is waiting on "I/O",
+  // so it keeps its priority.
+  if (pcb && pcb->pc - start == quantum && pcb->level + 1 < MLFQ_LEVELS)
+    {
+      pcb->level++;
+    }
+  return pcb;
+}
+
+const struct schedule_policy MLFQ = {
+  .run_pcb = run_mlfq,
+  .enqueue = enqueue_mlfq,
+  .dequeue = dequeue_mlfq,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+struct PCB *
+run_stride (struct PCB *pcb)
+{
+  size_t start = pcb->pc;
+  pcb = run_pcb_for_n_steps (pcb, 2);
+  // Charge for what actually ran, so a slice cut short by a page fault
+  // costs less than a full one.
+  if (pcb)
+    {
+      pcb->pass += pcb_stride (pcb) * (pcb->pc - start);
+    }
+  return pcb;
+}
+
+const struct schedule_policy STRIDE = {
+  .run_pcb = run_stride,
+  .enqueue = enqueue_stride,
+  .dequeue = dequeue_stride,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+struct PCB *
+run_cfs (struct PCB *pcb)
+{
+  size_t start = pcb->pc;
+  pcb = run_pcb_for_n_steps (pcb, pcb->slice);
+  if (pcb)
+    {
+      size_t weight = pcb->tickets ? pcb->tickets : 1;
+      pcb->vruntime += (pcb->pc - start) * 1000 * DEFAULT_TICKETS / weight;
+    }
+  return pcb;
+}
+
+const struct schedule_policy CFS = {
+  .run_pcb = run_cfs,
+  .enqueue = enqueue_cfs,
+  .dequeue = dequeue_cfs,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+// Runs until the process finishes, faults, or is preempted by a shorter
+// arrival (see enqueue_srtf).
+struct PCB *
+run_srtf (struct PCB *pcb)
+{
+  return run_pcb_for_n_steps (pcb, (size_t) -1);
+}
+
+const struct schedule_policy SRTF = {
+  .run_pcb = run_srtf,
+  .enqueue = enqueue_srtf,
+  .dequeue = dequeue_srtf,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
+// Missed deadlines, in the order the processes finished.
+struct deadline_miss
+{
+  char *name;
+  size_t deadline;
+  size_t finished;
+  struct deadline_miss *next;
+};
+static struct deadline_miss *misses = NULL, **misses_tail = &misses;
+static pthread_mutex_t misses_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct PCB *
+run_edf (struct PCB *pcb)
+{
+  // The PCB is no longer ours to look at once it finishes, so remember
+  // what we'll need to report a miss.
+  size_t deadline = pcb->deadline;
+  char *name = strdup (*pcb->name ? pcb->name : "(shell input)");
+
+  pcb = run_pcb_for_n_steps (pcb, (size_t) -1);
+
+  size_t now = instruction_clock ();
+  if (!pcb && deadline != NO_DEADLINE && now > deadline)
+    {
+      struct deadline_miss *miss = malloc (sizeof (struct deadline_miss));
+      miss->name = name;
+      miss->deadline = deadline;
+      miss->finished = now;
+      miss->next = NULL;
+      pthread_mutex_lock (&misses_lock);
+      *misses_tail = miss;
+      misses_tail = &miss->next;
+      pthread_mutex_unlock (&misses_lock);
+    }
+  else
+    {
+      free (name);
+    }
+  return pcb;
+}
+
+void
+report_edf ()
+{
+  pthread_mutex_lock (&misses_lock);
+  while (misses)
+    {
+      struct deadline_miss *miss = misses;
+      printf ("Missed deadline: %s finished at %zu, deadline was %zu\n",
+	      miss->name, miss->finished, miss->deadline);
+      misses = miss->next;
+      free (miss->name);
+      free (miss);
+    }
+  misses_tail = &misses;
+  pthread_mutex_unlock (&misses_lock);
+}
+
+const struct schedule_policy EDF = {
+  .run_pcb = run_edf,
+  .enqueue = enqueue_edf,
+  .dequeue = dequeue_srtf,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority,
+  .report = report_edf
+};
+
+const struct schedule_policy LOTTERY = {
+  .run_pcb = run_steps_2,
+  .enqueue = enqueue_fcfs,
+  .dequeue = dequeue_lottery,
+  .enqueue_ignoring_priority = enqueue_ignoring_priority
+};
+
 const struct schedule_policy AGING = {
   .run_pcb = run_steps_1,
   .enqueue = enqueue_aging,
@@ -45,7 +357,7 @@ const struct schedule_policy AGING = {
 };
 
 const struct schedule_policy *
-get_policy (const char *policy_name)
+get_policy (const char *policy_name, int top_level)
 {
   if (strcmp (policy_name, "FCFS") == 0)
     return &FCFS;
@@ -55,8 +367,44 @@ get_policy (const char *policy_name)
     return &RR;
   if (strcmp (policy_name, "RR30") == 0)
     return &RR30;
+  if (strcmp (policy_name, "RR:auto") == 0)
+    {
+      if (top_level)
+	reset_rr_auto ();
+      return &RR_AUTO;
+    }
+  if (strncmp (policy_name, "RR:", 3) == 0 && isdigit (policy_name[3]))
+    {
+      char *end;
+      size_t n = strtoul (policy_name + 3, &end, 10);
+      if (n == 0)
+	return NULL;
+      if (strcmp (end, "ms") == 0)
+	{
+	  if (top_level)
+	    rr_slice_usec = n * 1000;
+	  return &RR_TIMED;
+	}
+      if (*end != '\0')
+	return NULL;
+      if (top_level)
+	rr_quantum = n;
+      return &RR_N;
+    }
   if (strcmp (policy_name, "AGING") == 0)
     return &AGING;
+  if (strcmp (policy_name, "MLFQ") == 0)
+    return &MLFQ;
+  if (strcmp (policy_name, "STRIDE") == 0)
+    return &STRIDE;
+  if (strcmp (policy_name, "LOTTERY") == 0)
+    return &LOTTERY;
+  if (strcmp (policy_name, "CFS") == 0)
+    return &CFS;
+  if (strcmp (policy_name, "SRTF") == 0)
+    return &SRTF;
+  if (strcmp (policy_name, "EDF") == 0)
+    return &EDF;
 
   return NULL;
 }
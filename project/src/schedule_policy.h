@@ -17,12 +17,31 @@ struct schedule_policy
   // If an operation such as aging is to be performed on other members,
   // it is done at this time.
   struct PCB *(*dequeue) (struct queue *);
+  // Optional. Called once the whole schedule is complete, to print
+  // anything the policy has to say about how it went.
+  void (*report) (void);
 };
 
-const struct schedule_policy *get_policy (const char *policy_name);
+// Look up a policy by name, or return NULL if there isn't one. Some names
+// carry a parameter, like the n of RR:<n>. There's only ever one schedule
+// running, so that's kept in a variable for it, which is only set if
+// top_level is non-zero: a background exec joins the running schedule,
+// and must not change its quantum. Likewise, a top-level RR:auto starts
+// tuning its quantum from scratch.
+const struct schedule_policy *get_policy (const char *policy_name,
+					  int top_level);
 
 // Notes on particular policies:
 //
+// RR:<n>, RR:auto:
+//  Round robin with a quantum of n instructions, for any n > 0, or with a
+//  quantum that adapts to the measured cost of switching, the cost of an
+//  instruction, and how often slices are cut short by page faults. See
+//  run_steps_rr_auto in schedule_policy.c.
+// RR:<n>ms:
+//  Round robin with a quantum of n milliseconds of wall clock time, checked
+//  between instructions. How many instructions fit in a slice depends on
+//  what they are, so the interleaving isn't deterministic.
 // SJF:
 //  Ties are broken via FCFS.
 // Aging:
@@ -33,3 +52,30 @@ const struct schedule_policy *get_policy (const char *policy_name);
 //
 //  Otherwise (tie not at the head, or during first scheduling),
 //  we break ties with FCFS like SJF.
+// MLFQ:
+//  Three levels with quanta of 2, 4 and 8 instructions. Every process
+//  starts at the top. Using a full quantum demotes a process one level;
+//  being cut short by a page fault leaves it where it is. Every
+//  MLFQ_BOOST_INTERVAL dispatches, everything goes back to the top.
+//  Within a level, processes run FCFS.
+// STRIDE, LOTTERY:
+//  Each program's share of the CPU is proportional to its tickets, given
+//  on the exec line as `prog:tickets` (default DEFAULT_TICKETS). Both run
+//  2 instructions per slice. STRIDE always picks the lowest pass value,
+//  so shares are exact over any long window; LOTTERY picks at random, so
+//  they are only exact on average.
+// SRTF:
+//  Like SJF, but by remaining instructions rather than total length, and
+//  preemptive: when a background script execs a program with less work
+//  left than the script itself, the script is put back on the queue and
+//  the shortest job runs. Ties are broken FCFS.
+// EDF:
+//  Runs the process with the earliest deadline, given on the exec line as
+//  `prog@N` (N instructions after the exec), until it finishes or a more
+//  urgent process arrives. Programs without a deadline run last, FCFS.
+//  Deadlines missed are reported when the schedule completes.
+// CFS:
+//  Always runs the process with the least weighted virtual runtime
+//  (vruntime), with tickets as the weight. Instead of a fixed quantum,
+//  each dispatch runs for the process's share of a CFS_LATENCY-instruction
+//  period, with a floor of CFS_MIN_GRANULARITY; see queue.h.
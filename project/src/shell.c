@@ -6,6 +6,8 @@
 #include "shell.h"
 #include "interpreter.h"
 #include "shellmemory.h"
+#include "pcb.h"
+#include "trace.h"
 
 // Start of everything
 int
@@ -28,6 +30,7 @@ main (int argc, char *argv[])
 
   //init shell memory
   mem_init ();
+  trace_init ();
   while (1)
     {
       if (!batch_mode)
@@ -109,7 +112,11 @@ parseInput (const char inp[])
   if (w > 0)
     {
       // run the command
+      struct PCB *running = current_process ();
+      size_t running_pid = running ? running->pid : 0;
+      trace_event (TRACE_COMMAND_BEGIN, running_pid, -1, words[0]);
       errorCode = interpreter (words, w);
+      trace_event (TRACE_COMMAND_END, running_pid, -1, NULL);
       // cleanup all the words we parsed
       for (size_t i = 0; i < w; ++i)
 	{
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "shellmemory.h"
 
 #define true 1
@@ -36,6 +37,21 @@ get_current_time ()
 struct program_line linememory[VAR_MEM_SIZE];
 struct frame frame_store[NUM_FRAMES];
 
+// Initialized as a recursive mutex by mem_init.
+static pthread_mutex_t frame_store_lock;
+
+void
+lock_frame_store ()
+{
+  pthread_mutex_lock (&frame_store_lock);
+}
+
+void
+unlock_frame_store ()
+{
+  pthread_mutex_unlock (&frame_store_lock);
+}
+
 
 
 // We have two choices:
@@ -199,6 +215,9 @@ struct memory_struct
 };
 
 struct memory_struct shellmemory[FRAME_STORE_SIZE];
+// Scripts running on different workers may set and read variables
+// at the same time, so every access to shellmemory goes through this lock.
+static pthread_mutex_t shellmemory_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Helper functions
 int
@@ -232,6 +251,12 @@ mem_init ()
       shellmemory[i].value = "none";
     }
 
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&frame_store_lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+
   init_linemem ();
 }
 
@@ -241,12 +266,14 @@ mem_set_value (char *var_in, char *value_in)
 {
   int i;
 
+  pthread_mutex_lock (&shellmemory_lock);
   for (i = 0; i < FRAME_STORE_SIZE; i++)
     {
       if (strcmp (shellmemory[i].var, var_in) == 0)
 	{
 	  free (shellmemory[i].value);
 	  shellmemory[i].value = strdup (value_in);
+	  pthread_mutex_unlock (&shellmemory_lock);
 	  return;
 	}
     }
@@ -258,10 +285,12 @@ mem_set_value (char *var_in, char *value_in)
 	{
 	  shellmemory[i].var = strdup (var_in);
 	  shellmemory[i].value = strdup (value_in);
+	  pthread_mutex_unlock (&shellmemory_lock);
 	  return;
 	}
     }
 
+  pthread_mutex_unlock (&shellmemory_lock);
   return;
 }
 
@@ -270,15 +299,19 @@ char *
 mem_get_value (char *var_in)
 {
   int i;
+  char *value = NULL;
 
+  pthread_mutex_lock (&shellmemory_lock);
   for (i = 0; i < FRAME_STORE_SIZE; i++)
     {
       if (strcmp (shellmemory[i].var, var_in) == 0)
 	{
-	  return strdup (shellmemory[i].value);
+	  value = strdup (shellmemory[i].value);
+	  break;
 	}
     }
-  return NULL;
+  pthread_mutex_unlock (&shellmemory_lock);
+  return value;
 }
 
 
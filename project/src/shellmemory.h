@@ -24,6 +24,13 @@ void mem_set_value (char *var, char *value);
 int allocate_frame ();
 int get_current_time ();	// Function to get the current timestamp for LRU
 
+// The frame store is shared by every process. When processes run on
+// several worker threads (see workers.h), anything that reads or modifies
+// frame_store -- loading pages, faulting, freeing -- must hold this lock.
+// It is recursive, because e.g. create_process frees its PCB on failure.
+void lock_frame_store (void);
+void unlock_frame_store (void);
+
 struct program_line
 {
   int allocated;		// for sanity-checking
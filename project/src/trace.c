@@ -0,0 +1,115 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+// Events per thread. Once a ring is full, the oldest events are
+// overwritten, so a long run keeps its most recent history.
+#define TRACE_RING_SIZE (1 << 16)
+
+int trace_enabled = 0;
+static const char *trace_path;
+
+// Each ring is written only by its own thread, so recording an event
+// takes no locks or atomic read-modify-writes. Rings are pushed onto a
+// global list when first used, and never freed, so that they can all be
+// dumped at exit even after their threads are gone.
+struct trace_ring
+{
+  struct trace_event events[TRACE_RING_SIZE];
+  uint64_t written;
+  uint32_t thread;
+  struct trace_ring *next;
+};
+
+static _Atomic (struct trace_ring *) rings = NULL;
+static atomic_uint next_thread = 0;
+static __thread struct trace_ring *my_ring;
+
+static void trace_dump (void);
+
+void
+trace_init ()
+{
+  trace_path = getenv ("MYSH_TRACE");
+  if (!trace_path || !*trace_path)
+    return;
+  trace_enabled = 1;
+  atexit (trace_dump);
+}
+
+static struct trace_ring *
+new_ring ()
+{
+  struct trace_ring *ring = calloc (1, sizeof (struct trace_ring));
+  if (!ring)
+    return NULL;
+  ring->thread = atomic_fetch_add (&next_thread, 1);
+  ring->next = atomic_load (&rings);
+  while (!atomic_compare_exchange_weak (&rings, &ring->next, ring));
+  return ring;
+}
+
+void
+trace_record (enum trace_type type, uint32_t pid, int32_t frame,
+	      const char *label)
+{
+  if (!my_ring && !(my_ring = new_ring ()))
+    return;
+
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  struct trace_event *e =
+    &my_ring->events[my_ring->written++ % TRACE_RING_SIZE];
+  e->timestamp_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  e->pid = pid;
+  e->frame = frame;
+  e->type = type;
+  if (label)
+    strncpy (e->label, label, TRACE_LABEL_SIZE);
+  else
+    e->label[0] = '\0';
+}
+
+static void
+trace_dump ()
+{
+  // Stop recording, so that nothing we do from here on ends up in a ring
+  // while we're writing it out.
+  trace_enabled = 0;
+
+  FILE *f = fopen (trace_path, "wb");
+  if (!f)
+    {
+      perror ("MYSH_TRACE");
+      return;
+    }
+  struct trace_file_header header = {.magic = TRACE_MAGIC,
+    .threads = 0,
+    .event_size = sizeof (struct trace_event)
+  };
+  for (struct trace_ring * r = atomic_load (&rings); r; r = r->next)
+    header.threads++;
+  fwrite (&header, sizeof (header), 1, f);
+
+  for (struct trace_ring * r = atomic_load (&rings); r; r = r->next)
+    {
+      uint64_t kept =
+	r->written < TRACE_RING_SIZE ? r->written : TRACE_RING_SIZE;
+      struct trace_thread_header thread = {.thread = r->thread,
+	.events = kept,
+	.dropped = r->written - kept
+      };
+      fwrite (&thread, sizeof (thread), 1, f);
+      // Oldest first: if the ring has wrapped, that's the slot we'd
+      // write next.
+      uint64_t first = r->written - kept;
+      for (uint64_t i = first; i < r->written; i++)
+	fwrite (&r->events[i % TRACE_RING_SIZE], sizeof (struct trace_event),
+		1, f);
+    }
+  fclose (f);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+
+// Event tracing.
+//
+// If the MYSH_TRACE environment variable names a file when the shell
+// starts, every thread records fixed-size binary events into a ring buffer
+// of its own, and all the buffers are written to that file when the shell
+// exits. trace2json converts the file to Chrome's trace_event JSON, which
+// chrome://tracing or Perfetto can display.
+//
+// When tracing is off, trace_event costs a load and a branch.
+
+enum trace_type
+{
+  TRACE_DISPATCH,		// a process was given the CPU
+  TRACE_SLICE_END,		// ...and has given it up again
+  TRACE_PREEMPT,		// its slice was cut short by request_preemption
+  TRACE_FAULT_BEGIN,		// handle_page_fault started
+  TRACE_FAULT_END,		// ...and finished
+  TRACE_EVICT,			// frame was evicted; pid is its old owner's
+  TRACE_COMMAND_BEGIN,		// a command started; label is its name
+  TRACE_COMMAND_END
+};
+
+#define TRACE_LABEL_SIZE 12
+
+// The file is a struct trace_file_header, then for each thread a
+// struct trace_thread_header followed by its events, oldest first.
+struct trace_event
+{
+  uint64_t timestamp_ns;	// CLOCK_MONOTONIC
+  uint32_t pid;			// 0 if no process was running
+  int32_t frame;		// -1 if not applicable
+  uint16_t type;		// enum trace_type
+  char label[TRACE_LABEL_SIZE];	// not necessarily NUL-terminated
+  uint16_t reserved;
+};
+
+#define TRACE_MAGIC "MYSHTRC1"
+
+struct trace_file_header
+{
+  char magic[8];
+  uint32_t threads;
+  uint32_t event_size;		// sizeof (struct trace_event)
+};
+
+struct trace_thread_header
+{
+  uint32_t thread;		// 0 is the thread that started the shell
+  uint32_t events;
+  uint64_t dropped;		// events overwritten because the ring was full
+};
+
+// Read MYSH_TRACE and, if it's set, turn tracing on. Call once at startup.
+void trace_init (void);
+
+extern int trace_enabled;
+
+void trace_record (enum trace_type type, uint32_t pid, int32_t frame,
+		   const char *label);
+
+static inline void
+trace_event (enum trace_type type, uint32_t pid, int32_t frame,
+	     const char *label)
+{
+  if (__builtin_expect (trace_enabled, 0))
+    trace_record (type, pid, frame, label);
+}
@@ -0,0 +1,150 @@
+// Convert a trace written by mysh (see trace.h) to Chrome's trace_event
+// JSON format, for chrome://tracing or https://ui.perfetto.dev.
+//
+// Usage: trace2json TRACE [OUTPUT.json]
+//
+// Each shell thread becomes a track. Time slices, page faults and commands
+// become nested duration events; preemptions and evictions are instants.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static int first_event = 1;
+static uint64_t base_ns;
+
+static void
+emit (FILE * out, const char *name, const char *phase, uint32_t thread,
+      const struct trace_event *e)
+{
+  fprintf (out, "%s\n    {\"name\": \"", first_event ? "" : ",");
+  // Labels come from script text, so escape what JSON needs escaped.
+  for (const char *c = name; *c; c++)
+    {
+      if (*c == '"' || *c == '\\')
+	fputc ('\\', out);
+      if ((unsigned char) *c >= ' ')
+	fputc (*c, out);
+    }
+  fprintf (out, "\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": 1, "
+	   "\"tid\": %u", phase, (e->timestamp_ns - base_ns) / 1000.0,
+	   thread);
+  if (*phase == 'i')
+    fprintf (out, ", \"s\": \"t\"");
+  fprintf (out, ", \"args\": {\"pid\": %u", e->pid);
+  if (e->frame >= 0)
+    fprintf (out, ", \"frame\": %d", e->frame);
+  fprintf (out, "}}");
+  first_event = 0;
+}
+
+static void
+convert (FILE * out, const struct trace_event *e, uint32_t thread)
+{
+  char name[64];
+  switch (e->type)
+    {
+    case TRACE_DISPATCH:
+      snprintf (name, sizeof (name), "run pid %u", e->pid);
+      emit (out, name, "B", thread, e);
+      break;
+    case TRACE_SLICE_END:
+    case TRACE_FAULT_END:
+    case TRACE_COMMAND_END:
+      emit (out, "", "E", thread, e);
+      break;
+    case TRACE_PREEMPT:
+      emit (out, "preempt", "i", thread, e);
+      break;
+    case TRACE_FAULT_BEGIN:
+      emit (out, "page fault", "B", thread, e);
+      break;
+    case TRACE_EVICT:
+      emit (out, "evict", "i", thread, e);
+      break;
+    case TRACE_COMMAND_BEGIN:
+      snprintf (name, sizeof (name), "%.*s", TRACE_LABEL_SIZE, e->label);
+      emit (out, name, "B", thread, e);
+      break;
+    default:
+      fprintf (stderr, "trace2json: skipping unknown event type %u\n",
+	       e->type);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "Usage: %s TRACE [OUTPUT.json]\n", argv[0]);
+      return 2;
+    }
+  FILE *in = fopen (argv[1], "rb");
+  if (!in)
+    {
+      perror (argv[1]);
+      return 1;
+    }
+  FILE *out = argc == 3 ? fopen (argv[2], "w") : stdout;
+  if (!out)
+    {
+      perror (argv[2]);
+      return 1;
+    }
+
+  struct trace_file_header header;
+  if (fread (&header, sizeof (header), 1, in) != 1
+      || memcmp (header.magic, TRACE_MAGIC, sizeof (header.magic)) != 0
+      || header.event_size != sizeof (struct trace_event))
+    {
+      fprintf (stderr, "%s: not a mysh trace, or from another version\n",
+	       argv[1]);
+      return 1;
+    }
+
+  // Read everything first, to find the earliest timestamp: Chrome's
+  // viewer is much happier with times near 0.
+  struct trace_thread_header *threads =
+    calloc (header.threads, sizeof (struct trace_thread_header));
+  struct trace_event **events = calloc (header.threads,
+					sizeof (struct trace_event *));
+  base_ns = UINT64_MAX;
+  for (uint32_t t = 0; t < header.threads; t++)
+    {
+      if (fread (&threads[t], sizeof (threads[t]), 1, in) != 1)
+	{
+	  fprintf (stderr, "%s: truncated\n", argv[1]);
+	  return 1;
+	}
+      events[t] = malloc (sizeof (struct trace_event) * threads[t].events);
+      if (fread (events[t], sizeof (struct trace_event), threads[t].events,
+		 in) != threads[t].events)
+	{
+	  fprintf (stderr, "%s: truncated\n", argv[1]);
+	  return 1;
+	}
+      if (threads[t].events && events[t][0].timestamp_ns < base_ns)
+	base_ns = events[t][0].timestamp_ns;
+      if (threads[t].dropped)
+	fprintf (stderr, "trace2json: thread %u dropped its oldest %llu "
+		 "events\n", threads[t].thread,
+		 (unsigned long long) threads[t].dropped);
+    }
+  fclose (in);
+
+  fprintf (out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  for (uint32_t t = 0; t < header.threads; t++)
+    {
+      for (uint32_t i = 0; i < threads[t].events; i++)
+	convert (out, &events[t][i], threads[t].thread);
+      free (events[t]);
+    }
+  fprintf (out, "\n]}\n");
+  free (events);
+  free (threads);
+  if (out != stdout)
+    fclose (out);
+  return 0;
+}
@@ -6,6 +6,7 @@ struct TestCase
 {
   const char *inputFile;	// e.g., "../../A3/test-cases/tc1.txt"
   const char *expectedFile;	// e.g., "../../A3/test-cases/tc1_result.txt"
+  int framesize;		// frame store size to compile mysh with
 };
 
 int
@@ -13,11 +14,24 @@ main (void)
 {
   // List all your test cases here.
   struct TestCase testCases[] = {
-    {"../../A3/test-cases/tc1.txt", "../../A3/test-cases/tc1_result.txt"},
-    {"../../A3/test-cases/tc2.txt", "../../A3/test-cases/tc2_result.txt"},
-    {"../../A3/test-cases/tc3.txt", "../../A3/test-cases/tc3_result.txt"},
-    {"../../A3/test-cases/tc4.txt", "../../A3/test-cases/tc4_result.txt"},
-    {"../../A3/test-cases/tc5.txt", "../../A3/test-cases/tc5_result.txt"}
+    {"../../A3/test-cases/tc1.txt", "../../A3/test-cases/tc1_result.txt",
+     18},
+    {"../../A3/test-cases/tc2.txt", "../../A3/test-cases/tc2_result.txt",
+     18},
+    {"../../A3/test-cases/tc3.txt", "../../A3/test-cases/tc3_result.txt",
+     21},
+    {"../../A3/test-cases/tc4.txt", "../../A3/test-cases/tc4_result.txt",
+     18},
+    {"../../A3/test-cases/tc5.txt", "../../A3/test-cases/tc5_result.txt", 6},
+    // Our own tests for the policies added after A3.
+    {"../test-cases/T_MLFQ.txt", "../test-cases/T_MLFQ_result.txt", 30},
+    // 3:2:1 tickets over 24, 16 and 8 lines: all three should finish
+    // at about the same time.
+    {"../test-cases/T_STRIDE.txt", "../test-cases/T_STRIDE_result.txt", 60},
+    {"../test-cases/T_CFS.txt", "../test-cases/T_CFS_result.txt", 60},
+    {"../test-cases/T_RR_N.txt", "../test-cases/T_RR_N_result.txt", 18},
+    {"../test-cases/T_SRTF.txt", "../test-cases/T_SRTF_result.txt", 60},
+    {"../test-cases/T_EDF.txt", "../test-cases/T_EDF_result.txt", 60}
   };
 
   // Calculate the number of test cases
@@ -28,28 +42,14 @@ main (void)
   for (int i = 0; i < numTests; i++)
     {
       system ("make clean");
-      // Compile with the appropriate parameters based on the test number.
-      if (i == 0 || i == 1 || i == 3)
-	{
-	  printf
-	    ("Compiling mysh with framesize=18 varmemsiz=10 for test %d\n",
-	     i + 1);
-	  system ("make mysh framesize=18 varmemsiz=10");
-	}
-      else if (i == 2)
-	{
-	  printf
-	    ("Compiling mysh with framesize=21 varmemsiz=10 for test %d\n",
-	     i + 1);
-	  system ("make mysh framesize=21 varmemsiz=10");
-	}
-      else if (i == 4)
-	{
-	  printf
-	    ("Compiling mysh with framesize=6 varmemsiz=10 for test %d\n",
-	     i + 1);
-	  system ("make mysh framesize=6 varmemsiz=10");
-	}
+      // Compile with the frame store size the test case expects.
+      printf
+	("Compiling mysh with framesize=%d varmemsiz=10 for test %d\n",
+	 testCases[i].framesize, i + 1);
+      char makeCmd[128];
+      snprintf (makeCmd, sizeof (makeCmd),
+		"make mysh framesize=%d varmemsiz=10", testCases[i].framesize);
+      system (makeCmd);
 
       printf ("Running Test %d/%d\n", i + 1, numTests);
       printf ("  Input:    %s\n", testCases[i].inputFile);
@@ -0,0 +1,284 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>		// sysconf
+#include "pcb.h"
+#include "workers.h"
+
+// Scheduling structure
+// --------------------
+// A single shared ready queue would make every time slice of every worker
+// take the same lock twice, which is the bottleneck for short quanta
+// (e.g. RR's quantum of 2). Instead, each worker owns a local queue of PCBs
+// that it dequeues from and re-enqueues to with the policy's own functions,
+// so RR/SJF/AGING ordering is kept within each local queue. Only the owner
+// and the occasional thief ever take a local queue's lock.
+//
+// The shared queue that exec builds becomes an "injection" queue: workers
+// pull new PCBs from it, and background execs keep adding to it.
+// A worker that runs out of local work first checks the injection queue,
+// then tries to steal a PCB from the tail of another worker's queue, and
+// only then goes to sleep.
+
+// Every this many dispatches, a worker checks the injection queue before its
+// local queue, so newly exec'd programs aren't starved by a busy worker.
+#define INJECTION_CHECK_INTERVAL 61
+
+// Protects the injection queue and the sleep/wake protocol below.
+static pthread_mutex_t schedule_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t schedule_changed = PTHREAD_COND_INITIALIZER;
+
+struct worker
+{
+  pthread_mutex_t lock;
+  struct queue *local;
+  // Number of PCBs in local. Protected by lock.
+  size_t queued;
+};
+
+struct scheduler
+{
+  struct queue *injection;
+  const struct schedule_policy *policy;
+  struct worker *workers;
+  size_t n_workers;
+  // Number of PCBs that have left the injection queue but not yet finished,
+  // i.e. that are in some local queue or currently running. When this is
+  // zero and the injection queue is empty, the schedule is complete.
+  atomic_size_t outstanding;
+  // Number of workers asleep on schedule_changed (or about to be).
+  atomic_size_t idle;
+};
+
+struct worker_args
+{
+  struct scheduler *sched;
+  size_t self;
+};
+
+void
+lock_schedule ()
+{
+  pthread_mutex_lock (&schedule_lock);
+}
+
+void
+unlock_schedule ()
+{
+  pthread_cond_broadcast (&schedule_changed);
+  pthread_mutex_unlock (&schedule_lock);
+}
+
+size_t
+default_worker_count ()
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (size_t) n : 1;
+}
+
+// Wake sleeping workers, but only pay for the lock if there are any.
+static void
+wake_idle (struct scheduler *sched)
+{
+  if (atomic_load (&sched->idle) > 0)
+    {
+      pthread_mutex_lock (&schedule_lock);
+      pthread_cond_broadcast (&schedule_changed);
+      pthread_mutex_unlock (&schedule_lock);
+    }
+}
+
+// Like wake_idle, but for when there's only one PCB's worth of work to
+// hand out: waking everyone would just have them race to steal it.
+static void
+wake_one_idle (struct scheduler *sched)
+{
+  if (atomic_load (&sched->idle) > 0)
+    {
+      pthread_mutex_lock (&schedule_lock);
+      pthread_cond_signal (&schedule_changed);
+      pthread_mutex_unlock (&schedule_lock);
+    }
+}
+
+// Requires schedule_lock.
+static struct PCB *
+take_injected (struct scheduler *sched)
+{
+  struct PCB *pcb = sched->policy->dequeue (sched->injection);
+  if (pcb)
+    atomic_fetch_add (&sched->outstanding, 1);
+  return pcb;
+}
+
+static struct PCB *
+take_local (struct scheduler *sched, size_t self)
+{
+  struct worker *w = &sched->workers[self];
+  pthread_mutex_lock (&w->lock);
+  struct PCB *pcb = sched->policy->dequeue (w->local);
+  if (pcb)
+    w->queued--;
+  pthread_mutex_unlock (&w->lock);
+  return pcb;
+}
+
+static struct PCB *
+steal (struct scheduler *sched, size_t self)
+{
+  for (size_t i = 1; i < sched->n_workers; ++i)
+    {
+      struct worker *victim = &sched->workers[(self + i) % sched->n_workers];
+      pthread_mutex_lock (&victim->lock);
+      struct PCB *pcb = steal_pcb (victim->local);
+      if (pcb)
+	victim->queued--;
+      pthread_mutex_unlock (&victim->lock);
+      if (pcb)
+	return pcb;
+    }
+  return NULL;
+}
+
+// Find the next PCB for worker self to run, sleeping if there's nothing
+// to do right now. Returns NULL once the whole schedule is done.
+static struct PCB *
+find_work (struct scheduler *sched, size_t self, size_t dispatches)
+{
+  struct PCB *pcb = NULL;
+
+  if (dispatches % INJECTION_CHECK_INTERVAL == 0)
+    {
+      pthread_mutex_lock (&schedule_lock);
+      pcb = take_injected (sched);
+      pthread_mutex_unlock (&schedule_lock);
+      if (pcb)
+	return pcb;
+    }
+
+  pcb = take_local (sched, self);
+  if (pcb)
+    return pcb;
+
+  pthread_mutex_lock (&schedule_lock);
+  while (1)
+    {
+      pcb = take_injected (sched);
+      if (pcb)
+	break;
+
+      // Announce that we might sleep *before* looking at the other queues.
+      // Anyone who makes work available after we've looked will then see
+      // idle > 0 and wake us up (see wake_idle).
+      atomic_fetch_add (&sched->idle, 1);
+      pcb = steal (sched, self);
+      if (pcb)
+	{
+	  atomic_fetch_sub (&sched->idle, 1);
+	  break;
+	}
+      if (atomic_load (&sched->outstanding) == 0)
+	{
+	  // Nothing is queued anywhere, and nothing is running that could
+	  // exec more. We're done; make sure everyone else notices too.
+	  atomic_fetch_sub (&sched->idle, 1);
+	  pthread_cond_broadcast (&schedule_changed);
+	  break;
+	}
+      pthread_cond_wait (&schedule_changed, &schedule_lock);
+      atomic_fetch_sub (&sched->idle, 1);
+    }
+  pthread_mutex_unlock (&schedule_lock);
+  return pcb;
+}
+
+static void *
+worker_main (void *arg)
+{
+  struct worker_args *args = arg;
+  struct scheduler *sched = args->sched;
+  struct worker *self = &sched->workers[args->self];
+  size_t dispatches = 1;
+
+  struct PCB *pcb;
+  while ((pcb = find_work (sched, args->self, dispatches++)))
+    {
+      pcb = sched->policy->run_pcb (pcb);
+
+      if (pcb)
+	{
+	  pthread_mutex_lock (&self->lock);
+	  sched->policy->enqueue (self->local, pcb);
+	  size_t queued = ++self->queued;
+	  pthread_mutex_unlock (&self->lock);
+	  // We'll take the next PCB ourselves, so there's only something for
+	  // an idle worker to steal if that leaves another one behind.
+	  // Otherwise a lone PCB would bounce between workers every slice.
+	  if (queued > 1)
+	    wake_one_idle (sched);
+	}
+      else if (atomic_fetch_sub (&sched->outstanding, 1) == 1)
+	{
+	  // That was the last one; sleepers may need to learn that we're done.
+	  wake_idle (sched);
+	}
+    }
+  return NULL;
+}
+
+void
+runScheduleParallel (struct queue *q, const struct schedule_policy *policy,
+		     size_t n_workers)
+{
+  struct scheduler sched = {
+    .injection = q,
+    .policy = policy,
+    .workers = malloc (sizeof (struct worker) * n_workers),
+    .n_workers = n_workers,
+    .outstanding = 0,
+    .idle = 0
+  };
+  struct worker_args *args = malloc (sizeof (struct worker_args) * n_workers);
+  pthread_t *threads = malloc (sizeof (pthread_t) * n_workers);
+
+  for (size_t i = 0; i < n_workers; ++i)
+    {
+      pthread_mutex_init (&sched.workers[i].lock, NULL);
+      sched.workers[i].local = alloc_queue ();
+      sched.workers[i].queued = 0;
+      args[i].sched = &sched;
+      args[i].self = i;
+    }
+
+  size_t started = 0;
+  for (; started < n_workers; ++started)
+    {
+      if (pthread_create (&threads[started], NULL, worker_main,
+			  &args[started]))
+	{
+	  perror ("runScheduleParallel: could not start worker");
+	  break;
+	}
+    }
+
+  // If we couldn't start any workers at all, run the schedule ourselves.
+  // Otherwise, the workers that did start will steal from the others'
+  // (empty) queues, so nothing is lost.
+  if (started == 0)
+    worker_main (&args[0]);
+
+  for (size_t i = 0; i < started; ++i)
+    {
+      pthread_join (threads[i], NULL);
+    }
+
+  for (size_t i = 0; i < n_workers; ++i)
+    {
+      free_queue (sched.workers[i].local);
+      pthread_mutex_destroy (&sched.workers[i].lock);
+    }
+  free (threads);
+  free (args);
+  free (sched.workers);
+}
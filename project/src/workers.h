@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include "queue.h"
+#include "schedule_policy.h"
+
+// Multi-threaded ("MT") execution of a schedule.
+//
+// runSchedule in interpreter.c runs one PCB at a time on the main thread,
+// which is what the assignments ask for: output is then fully determined
+// by the policy. That remains the default. `exec ... POLICY [#] MT` instead
+// hands the queue to a pool of worker threads, each of which repeatedly
+// dequeues a PCB, runs one time slice of it with policy->run_pcb, and
+// re-enqueues it on its own local queue, stealing from the other workers
+// when it runs dry (see workers.c). A PCB is only ever on one worker at
+// a time, so each
+// process's own output stays in order; only the interleaving between
+// different processes becomes nondeterministic.
+
+// Run every PCB on q to completion using n_workers threads, and return
+// once the queue is empty and no worker is running anything.
+void runScheduleParallel (struct queue *q, const struct schedule_policy *policy,
+			  size_t n_workers);
+
+// The queue passed to runScheduleParallel is shared by all workers, which
+// take new PCBs from it. Anything else that touches that queue while a
+// schedule may be running -- in practice, an exec issued from a background
+// script -- must bracket its work with these.
+// unlock_schedule also wakes any idle workers, since the queue may have
+// gained new PCBs.
+void lock_schedule (void);
+void unlock_schedule (void);
+
+// The number of workers `MT` uses when no count is given: one per online CPU.
+size_t default_worker_count (void);